@@ -1,113 +1,767 @@
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
 #include <memory>
 #include <regex>
+#include <sstream>
 #include <vector>
+#include <pthread.h>
+#include <sched.h>
 #include <opencv2/core.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
 
+#include "async_lut.hpp"
 #include "common.hpp"
+#include "compositor.hpp"
+#include "frame_input.hpp"
+#include "framebuffer.hpp"
+#include "lut_cache.hpp"
+#include "lut_methods.hpp"
+#include "perf_counters.hpp"
+#include "streaming.hpp"
+#include "swappable_lut.hpp"
+#include "thread_pool.hpp"
 
 using namespace std;
 using namespace cv;
 
 
+/* every mode runs its own frame loop, so at most one is selected; STILL warps the image or [input] [repeat] times */
+enum class Mode { STILL, QUADS, OUTPUT, STREAM, ASYNC, RECALIBRATE };
 
-bool parse_args(int argc, char** argv, 
-                string& lut_method, string& image_path, 
-                Point2f& tl, Point2f& tr, Point2f& br, Point2f& bl,
-                Size& resolution,
-                bool& no_gui,
-                int& repeat);
-
-
-int main(int argc, char** argv)
+struct AppConfig
 {
-    string lut_method, image_path;
-    Point2f tl, tr, br, bl;
+    string method;
+    string image_path;
+    vector<Point2f> corners;    // TL, TR, BR, BL
     Size resolution;
     bool no_gui;
     int repeat;
+    ins::LUTOptions options;
+    vector<int> cpus;           // the pool pins worker i to cpus[i % cpus.size()] and the caller to cpus[0]
+    string cache_dir;
+    int cache_flags;
+    Mode mode;
+    int recalibrate_every;
+    string stream_source;
+    int stream_depth;
+    vector<vector<Point2f>> extra_quads;
+    string output_path;
+    bool vsync;
+    bool stand_in;
+    string input_spec;
+    Size input_size;
+    string map_path;
+    Vec2d distortion;
+    int async_depth;
+};
 
-    if (!parse_args(argc, argv, lut_method, image_path, tl, tr, br, bl, resolution, no_gui, repeat))
-    {
-        return EXIT_FAILURE;
-    }
+typedef chrono::high_resolution_clock::time_point TimePoint;
+
+
+bool parse_args(int argc, char** argv, AppConfig& config);
+
+void convert_frame(const Mat& bgr_image, Mat& frame, ins::PixelFormat format);
+Mat create_screen(Size resolution, ins::PixelFormat format);
+Mat display_frame(const Mat& screen, ins::PixelFormat format);
+int pixel_stride(const Mat& frame, ins::PixelFormat format);
 
-    Mat image = imread(image_path);
-    if (image.empty())
+
+/* The quad and every [quads] entry become surfaces of one screen, each above the previous. All of them show the same
+ * image; the single composite pass is compared against one [method] pass per surface, the first of which is @lut.
+ */
+static int run_quads(const AppConfig& config, const ins::LUTMethod& method, const ins::Geometry& geometry,
+                     unique_ptr<ins::LUT> lut, const Mat& image, const Mat& screen)
+{
+    const ins::LUTOptions& options = config.options;
+    uint* screen_buffer = reinterpret_cast<uint*>(screen.data);
+
+    vector<vector<Point2f>> quads = { config.corners };
+    quads.insert(quads.end(), config.extra_quads.begin(), config.extra_quads.end());
+
+    vector<ins::CompositeSurface> surfaces;
+    vector<unique_ptr<ins::LUT>> passes;
+    for (size_t i = 0; i < quads.size(); i++)
     {
-        printf("Failed to load the image!\n");
-        return EXIT_FAILURE;
+        Mat surface_mat = ins::get_transform_matrix(quads[i], geometry.source);
+        surfaces.emplace_back(surface_mat, geometry.source, static_cast<int>(i), geometry.source_stride);
+        passes.push_back(i == 0 ? move(lut) : method.create(surface_mat, geometry, screen_buffer, options));
     }
-    cvtColor(image, image, COLOR_BGR2BGRA);
-    
-    Mat screen = Mat::zeros(resolution.height, resolution.width, CV_8UC4);
-    uint* screen_buffer = reinterpret_cast<uint*>(screen.data);
 
-    vector<Point2f> points = { tl, tr, br, bl };
-    Mat trans_mat = ins::get_transform_matrix(points);
-    unique_ptr<ins::LUT> lut = nullptr;
-    string generated_class_info = "LUT method : ";
-    if (lut_method.compare("plain") == 0)
+    auto composite_start = chrono::high_resolution_clock::now();
+    ins::Compositor compositor(surfaces, geometry.screen, geometry.screen_stride, options.tile_size);
+    /* the compositor runs on the same backend as the passes; with [counters] each side gets its own profiler */
+    shared_ptr<ins::LUTProfiler> composite_profiler = options.profiler ? make_shared<ins::LUTProfiler>() : nullptr;
+    compositor.set_thread_pool(options.pool);
+    compositor.set_profiler(composite_profiler);
+    auto composite_end = chrono::high_resolution_clock::now();
+    printf("Compositor build took %lld ms\n%s\n",
+           static_cast<long long>(chrono::duration_cast<chrono::milliseconds>(composite_end - composite_start).count()),
+           compositor.summary().c_str());
+
+    const uint* image_data = reinterpret_cast<const uint*>(image.data);
+    vector<const uint*> sources(surfaces.size(), image_data);
+    vector<double> surface_us(surfaces.size(), 0), separate_us(surfaces.size(), 0);
+    double composite_us = 0;
+    auto elapsed_us = [](chrono::high_resolution_clock::time_point from) {
+        return chrono::duration<double, micro>(chrono::high_resolution_clock::now() - from).count();
+    };
+
+    int frames = 0;
+    for (; frames < config.repeat; frames++)
     {
-        generated_class_info += "PlainLUT";
-        lut = make_unique<ins::PlainLUT>(trans_mat, DISPLAY_W, DISPLAY_H, screen_buffer);
+        /* bottom surface first, so the separate passes leave the same surface on top as the compositor */
+        auto separate_passes = [&]{
+            for (size_t s = 0; s < passes.size(); s++)
+            {
+                auto start = chrono::high_resolution_clock::now();
+                passes[s]->apply(image_data);
+                separate_us[s] += elapsed_us(start);
+            }
+        };
+        if (options.profiler)
+            options.profiler->measure_apply(separate_passes);
+        else
+            separate_passes();
+        /* the per-surface shares stay out of the composite pass's counters */
+        compositor.set_profiler(nullptr);
+        for (size_t s = 0; s < surfaces.size(); s++)
+        {
+            auto start = chrono::high_resolution_clock::now();
+            compositor.apply_surface(static_cast<int>(s), image_data, screen_buffer);
+            surface_us[s] += elapsed_us(start);
+        }
+        compositor.set_profiler(composite_profiler);
+
+        auto start = chrono::high_resolution_clock::now();
+        if (composite_profiler)
+            composite_profiler->measure_apply([&]{ compositor.apply(sources, screen_buffer); });
+        else
+            compositor.apply(sources, screen_buffer);
+        double frame_us = elapsed_us(start);
+        composite_us += frame_us;
+        printf("Composite frame took %.1f us\n", frame_us);
+
+        if (!config.no_gui)
+        {
+            imshow("screen", display_frame(screen, options.format));
+            if ((waitKey(1) & 0xFF) == 27)
+            {
+                frames++;
+                break;
+            }
+        }
     }
-    else if (lut_method.compare("parallel") == 0)
+
+    double separate_total = 0;
+    for (size_t s = 0; s < surfaces.size(); s++)
     {
-        generated_class_info += "ParallelLUT";
-        lut = make_unique<ins::ParallelLUT>(trans_mat, DISPLAY_W, DISPLAY_H, screen_buffer);
+        separate_total += separate_us[s];
+        printf("Surface %zu : %.1f%% of screen on top, composite share mean %.1f us, separate %s pass mean %.1f us\n",
+               s, 100. * compositor.visible_pixels(static_cast<int>(s)) / geometry.screen.area(),
+               surface_us[s] / frames, config.method.c_str(), separate_us[s] / frames);
     }
-#ifdef __arm__
-    else if (lut_method.compare("plain-o1") == 0)
+    printf("Total frame : composite mean %.1f us, separate passes mean %.1f us\n", composite_us / frames, separate_total / frames);
+    if (options.profiler)
+        printf("Composite pass:\n%s\nSeparate passes:\n%s\n", composite_profiler->report().c_str(), options.profiler->report().c_str());
+    return EXIT_SUCCESS;
+}
+
+/* Every frame is warped straight into the back page of @output and flipped. For comparison the frame is also warped
+ * into a heap screen and copied to the display, the least the imshow path has to do, and shown with imshow.
+ */
+static int run_output(const AppConfig& config, const ins::LUTMethod& method, const ins::Warp& warp, const ins::Geometry& geometry,
+                      ins::LUT& lut, const Mat& image, ins::FramebufferOutput& output)
+{
+    const ins::LUTOptions& options = config.options;
+    auto relocatable = dynamic_cast<ins::RelocatableLUT*>(&lut);
+    if (!relocatable && output.pages() > 1)
+        printf("Warning: %s is bound to one page, so it is flipped to once and then drawn in place\n", config.method.c_str());
+
+    Mat heap_screen = create_screen(config.resolution, options.format);
+    ins::Geometry heap_geometry(geometry.source, geometry.screen, geometry.source_stride, pixel_stride(heap_screen, options.format));
+    unique_ptr<ins::LUT> heap_lut = method.create(warp, heap_geometry, reinterpret_cast<uint*>(heap_screen.data), options);
+    const uint* image_data = reinterpret_cast<const uint*>(image.data);
+    size_t row_bytes = heap_screen.cols * heap_screen.elemSize();
+
+    typedef chrono::high_resolution_clock clock;
+    auto elapsed_us = [](clock::time_point from, clock::time_point to) {
+        return chrono::duration<double, micro>(to - from).count();
+    };
+    double direct_us = 0, flip_us = 0, heap_us = 0, copy_us = 0, show_us = 0;
+
+    int frames = 0;
+    for (; frames < config.repeat; frames++)
     {
-        generated_class_info += "LoadStoreMultipleLUT";
-        lut = make_unique<ins::LoadStoreMultipleLUT>(trans_mat, DISPLAY_W, DISPLAY_H, screen_buffer);
+        auto heap_start = clock::now();
+        heap_lut->apply(image_data);
+        auto heap_warped = clock::now();
+        Mat back = output.back_mat();
+        for (int y = 0; y < heap_screen.rows; y++)
+            memcpy(back.ptr(y), heap_screen.ptr(y), row_bytes);
+        auto heap_copied = clock::now();
+        bool keep_going = true;
+        if (!config.no_gui)
+        {
+            imshow("screen", display_frame(heap_screen, options.format));
+            keep_going = (waitKey(1) & 0xFF) != 27;
+        }
+        auto heap_shown = clock::now();
+
+        auto start = clock::now();
+        if (relocatable)
+            relocatable->apply(image_data, output.back_buffer());
+        else
+            lut.apply(image_data);
+        auto warped = clock::now();
+        if (relocatable || frames == 0)
+            output.flip(config.vsync);
+        auto flipped = clock::now();
+
+        direct_us += elapsed_us(start, warped);
+        flip_us += elapsed_us(warped, flipped);
+        heap_us += elapsed_us(heap_start, heap_warped);
+        copy_us += elapsed_us(heap_warped, heap_copied);
+        show_us += elapsed_us(heap_copied, heap_shown);
+        printf("Direct frame took %.1f us (flip %.1f us), heap frame and copy took %.1f us\n",
+               elapsed_us(start, warped), elapsed_us(warped, flipped), elapsed_us(heap_start, heap_copied));
+
+        if (!keep_going)
+        {
+            frames++;
+            break;
+        }
     }
-    else if (lut_method.compare("parallel-o1") == 0)
+
+    double heap_total = (heap_us + copy_us + show_us) / frames;
+    printf("Direct : warp mean %.1f us, flip mean %.1f us%s\n", direct_us / frames, flip_us / frames, config.vsync ? " (waits for vsync)" : "");
+    printf("Heap   : warp mean %.1f us, copy to output mean %.1f us, imshow mean %.1f us\n", heap_us / frames, copy_us / frames, show_us / frames);
+    printf("Saved per frame : %.1f us against warp + copy%s\n",
+           heap_total - (direct_us + (config.vsync ? 0 : flip_us)) / frames, config.no_gui ? "" : " + imshow");
+    return EXIT_SUCCESS;
+}
+
+/* Decode, warp and present run as pipeline stages instead of warping the still image [repeat] times. Frames come from
+ * @capture when it is open, otherwise @bgr_image is the synthetic stream.
+ */
+static int run_stream(const AppConfig& config, ins::LUT& lut, Mat bgr_image, VideoCapture& capture)
+{
+    const ins::LUTOptions& options = config.options;
+    auto relocatable = dynamic_cast<ins::RelocatableLUT*>(&lut);
+    if (!relocatable)
     {
-        generated_class_info += "ParallelLoadStoreMultipleLUT";
-        lut = make_unique<ins::ParallelLoadStoreMultipleLUT>(trans_mat, DISPLAY_W, DISPLAY_H, screen_buffer);
+        printf("%s cannot write into the pipeline's screen buffers\n", config.method.c_str());
+        return EXIT_FAILURE;
     }
-#endif
-    else
+
+    /* the synthetic stream is the still image with an inverted band sweeping across it */
+    Mat synthetic = bgr_image.clone();
+    int band_x = -1;
+    auto invert_band = [&](int x) {
+        for (int y = 0; y < synthetic.rows; y++)
+        {
+            uchar* row = synthetic.ptr(y) + x * 3;
+            for (int i = 0; i < 32 * 3; i++)
+                row[i] = ~row[i];
+        }
+    };
+
+    bool first_frame = true;
+    auto source = [&](Mat& frame) {
+        if (capture.isOpened())
+        {
+            /* the first frame was read while opening the stream */
+            if (!first_frame && !capture.read(bgr_image))
+                return false;
+            first_frame = false;
+            convert_frame(bgr_image, frame, options.format);
+        }
+        else
+        {
+            if (band_x >= 0)
+                invert_band(band_x);
+            band_x = (band_x + 8) % max(1, synthetic.cols - 32);
+            invert_band(band_x);
+            convert_frame(synthetic, frame, options.format);
+        }
+        return true;
+    };
+    auto sink = [&](const Mat& frame) {
+        if (config.no_gui)
+            return true;
+        imshow("screen", display_frame(frame, options.format));
+        return (waitKey(1) & 0xFF) != 27;
+    };
+
+    ins::StreamingPipeline pipeline(*relocatable, source, sink,
+                                    [&]{ Mat frame; convert_frame(bgr_image, frame, options.format); return frame; },
+                                    [&]{ return create_screen(config.resolution, options.format); },
+                                    config.stream_depth);
+    ins::StreamStats stats = pipeline.run(config.repeat);
+    printf("%s\n", stats.report().c_str());
+    return EXIT_SUCCESS;
+}
+
+/* Frame i is warped on the AsyncLUT thread into a ring of [async] screens while frame i - 1 is presented. The same
+ * frames are first run synchronously, warp then present, into @screen for comparison. Presenting converts the screen
+ * for display and copies it out, the least the imshow path has to do, and shows it unless [no-gui].
+ */
+static int run_async(const AppConfig& config, ins::LUT& lut, const Mat& image, const Mat& screen)
+{
+    const ins::LUTOptions& options = config.options;
+    const int repeat = config.repeat, async_depth = config.async_depth;
+    auto relocatable = dynamic_cast<ins::RelocatableLUT*>(&lut);
+    if (!relocatable)
     {
-        printf("Unrecognizable method name! : %s\n", lut_method.c_str());
+        printf("%s cannot write into the ring's screen buffers\n", config.method.c_str());
         return EXIT_FAILURE;
     }
 
-    printf("%s\n", generated_class_info.c_str());
+    typedef chrono::steady_clock clock;
+    auto elapsed_us = [](clock::time_point from, clock::time_point to) {
+        return chrono::duration<double, micro>(to - from).count();
+    };
+    const uint* image_data = reinterpret_cast<const uint*>(image.data);
+    Mat shown;
+    auto present = [&](const Mat& frame) {
+        display_frame(frame, options.format).copyTo(shown);
+        if (config.no_gui)
+            return true;
+        imshow("screen", shown);
+        return (waitKey(1) & 0xFF) != 27;
+    };
 
+    ins::StreamStats sync_stats;
+    auto sync_start = clock::now();
     for (int i = 0; i < repeat; i++)
     {
+        auto start = clock::now();
+        relocatable->apply(image_data, reinterpret_cast<uint*>(screen.data));
+        auto warped = clock::now();
+        bool keep_going = present(screen);
+        auto end = clock::now();
+
+        int n = ++sync_stats.frames;
+        sync_stats.warp.add(elapsed_us(start, warped), n);
+        sync_stats.present.add(elapsed_us(warped, end), n);
+        sync_stats.latency.add(elapsed_us(start, end), n);
+        if (!keep_going)
+            break;
+    }
+    sync_stats.seconds = elapsed_us(sync_start, clock::now()) / 1e6;
+
+    /* declared before the AsyncLUT, so they outlive the warps it drains on destruction */
+    vector<Mat> screens;
+    for (int i = 0; i < async_depth; i++)
+        screens.push_back(create_screen(config.resolution, options.format));
+    vector<clock::time_point> submitted(repeat), completed(repeat);
+
+    struct InFlight
+    {
+        future<void> done;
+        int sequence;
+    };
+    ins::AsyncLUT async_lut(*relocatable);
+    deque<InFlight> in_flight;
+    ins::StreamStats async_stats;
+    ins::StreamStats::Stage waited;
+    bool keep_going = true;
+
+    auto present_oldest = [&]{
+        InFlight frame = move(in_flight.front());
+        in_flight.pop_front();
+        auto start = clock::now();
+        frame.done.get();
+        auto ready = clock::now();
+        keep_going = present(screens[frame.sequence % async_depth]);
+        auto end = clock::now();
+
+        /* the warp thread runs the frames in order, so a warp starts when it was submitted or the previous one finished */
+        int i = frame.sequence;
+        clock::time_point warp_start = i > 0 ? max(submitted[i], completed[i - 1]) : submitted[i];
+        int n = ++async_stats.frames;
+        async_stats.warp.add(elapsed_us(warp_start, completed[i]), n);
+        waited.add(elapsed_us(start, ready), n);
+        async_stats.present.add(elapsed_us(ready, end), n);
+        async_stats.latency.add(elapsed_us(submitted[i], end), n);
+    };
+
+    auto async_start = clock::now();
+    for (int i = 0; i < repeat && keep_going; i++)
+    {
+        /* the slot last held frame i - [async], which has been presented by now */
+        uint* slot = reinterpret_cast<uint*>(screens[i % async_depth].data);
+        submitted[i] = clock::now();
+        in_flight.push_back({ async_lut.apply_async(image_data, slot, [&completed, i](uint*){ completed[i] = clock::now(); }), i });
+
+        /* one screen is presented while the others hold frames queued or being warped */
+        if (static_cast<int>(in_flight.size()) == async_depth)
+            present_oldest();
+    }
+    while (keep_going && !in_flight.empty())
+        present_oldest();
+    async_stats.seconds = elapsed_us(async_start, clock::now()) / 1e6;
+
+    printf("Sync  : %d frames, %.1f fps, warp mean %.1f us, present mean %.1f us, latency mean %.1f us, max %.1f us\n",
+           sync_stats.frames, sync_stats.fps(), sync_stats.warp.mean_us, sync_stats.present.mean_us,
+           sync_stats.latency.mean_us, sync_stats.latency.max_us);
+    printf("Async : %d frames, %.1f fps, warp mean %.1f us, waited for warp mean %.1f us, present mean %.1f us, latency mean %.1f us, max %.1f us (ring of %d screens)\n",
+           async_stats.frames, async_stats.fps(), async_stats.warp.mean_us, waited.mean_us, async_stats.present.mean_us,
+           async_stats.latency.mean_us, async_stats.latency.max_us, async_depth);
+    if (sync_stats.fps() > 0)
+        printf("Async throughput : %.2fx the synchronous loop, latency %+.1f us\n",
+               async_stats.fps() / sync_stats.fps(), async_stats.latency.mean_us - sync_stats.latency.mean_us);
+    return EXIT_SUCCESS;
+}
+
+/* Warps @image, or the frames of @input when it is set, into @screen [repeat] times and prints each frame's time.
+ * @before_frame runs ahead of frame i, @after_frame gets its warp time; either may be empty.
+ */
+static int run_frames(const AppConfig& config, ins::LUT& lut, const Mat& image, ins::FrameInput* input, const Mat& screen,
+                      TimePoint program_start,
+                      const function<void(int)>& before_frame = nullptr,
+                      const function<void(int, double)>& after_frame = nullptr)
+{
+    const ins::LUTOptions& options = config.options;
+    for (int i = 0; i < config.repeat; i++)
+    {
+        if (before_frame)
+            before_frame(i);
+
+        const uint* frame_data = reinterpret_cast<const uint*>(image.data);
+        if (input && !(frame_data = input->acquire(chrono::seconds(1))))
+        {
+            printf("No frame from the input for 1 s, stopping\n");
+            break;
+        }
+
         auto start = chrono::high_resolution_clock::now();
 
-        lut->apply(reinterpret_cast<uint*>(image.data));
+        if (options.profiler)
+            options.profiler->measure_apply([&]{ lut.apply(frame_data); });
+        else
+            lut.apply(frame_data);
 
         auto end = chrono::high_resolution_clock::now();
+
+        /* the screen holds the warped frame now, so the input may reuse its memory */
+        if (input)
+            input->release();
+        if (after_frame)
+            after_frame(i, chrono::duration<double, micro>(end - start).count());
         auto duration_ms = chrono::duration_cast<chrono::milliseconds>(end - start).count();
         auto duration_us = chrono::duration_cast<chrono::microseconds>(end - start).count();
         printf("Operations took %lld ms, %lld us\n", duration_ms, duration_us);
 
-        if (!no_gui)
+        if (i == 0)
         {
-            imshow("screen", screen);
+            auto startup_us = chrono::duration_cast<chrono::microseconds>(end - program_start).count();
+            printf("Startup to first frame took %lld ms, %lld us\n",
+                   static_cast<long long>(startup_us / 1000), static_cast<long long>(startup_us));
+        }
+
+        if (!config.no_gui)
+        {
+            imshow("screen", display_frame(screen, options.format));
             if ((waitKey(1) & 0xFF) == 27) break;
         }
     }
 
+    if (input)
+        printf("%s\n", input->summary().c_str());
+    if (options.profiler)
+        printf("%s\n", options.profiler->report().c_str());
     return EXIT_SUCCESS;
 }
 
+/* Live recalibration: runs the frames of run_frames while the corners are nudged back and forth every [recalibrate]
+ * frames and @lut is rebuilt in the background, then reports the frame-time jitter of the steady and rebuilding frames.
+ */
+static int run_recalibrate(const AppConfig& config, const ins::LUTMethod& method, const ins::Geometry& geometry,
+                           unique_ptr<ins::LUT> lut, const Mat& image, ins::FrameInput* input, const Mat& screen,
+                           TimePoint program_start)
+{
+    const int every = config.recalibrate_every;
+    uint* screen_buffer = reinterpret_cast<uint*>(screen.data);
+    auto factory = [&](Mat transform_matrix) {
+        return method.create(transform_matrix, geometry, screen_buffer, config.options);
+    };
+    ins::SwappableLUT swappable(factory, move(lut), geometry.source);
+
+    const Point2f tl = config.corners[0], tr = config.corners[1], br = config.corners[2], bl = config.corners[3];
+    vector<double> steady_frame_us, swapping_frame_us;
+    int swaps_before = 0;
+    bool rebuilding = false;
+    auto before_frame = [&](int i) {
+        if (i > 0 && i % every == 0)
+        {
+            float nudge = (i / every) % 2 ? 8.f : 0.f;
+            swappable.recalibrate({ tl + Point2f(nudge, nudge), tr + Point2f(-nudge, nudge), br + Point2f(-nudge, -nudge), bl + Point2f(nudge, -nudge) });
+        }
+        swaps_before = swappable.swap_count();
+        rebuilding = swappable.rebuilding();
+    };
+    auto after_frame = [&](int, double frame_us) {
+        if (rebuilding || swappable.swap_count() != swaps_before)
+            swapping_frame_us.push_back(frame_us);
+        else
+            steady_frame_us.push_back(frame_us);
+    };
+    int result = run_frames(config, swappable, image, input, screen, program_start, before_frame, after_frame);
+
+    auto report = [](const char* label, const vector<double>& frame_us) {
+        if (frame_us.empty())
+            return;
+        double mean = 0, variance = 0;
+        for (double t : frame_us)
+            mean += t;
+        mean /= frame_us.size();
+        for (double t : frame_us)
+            variance += (t - mean) * (t - mean);
+        variance /= frame_us.size();
+        printf("%s frames: %zu, mean %.1f us, stddev %.1f us, max %.1f us\n",
+               label, frame_us.size(), mean, sqrt(variance), *max_element(frame_us.begin(), frame_us.end()));
+    };
+    printf("LUT swaps : %d\n", swappable.swap_count());
+    if (swappable.failure_count() > 0)
+        printf("Failed rebuilds : %d, the last with : %s\n", swappable.failure_count(), swappable.last_failure().c_str());
+    report("Steady", steady_frame_us);
+    report("Rebuilding", swapping_frame_us);
+    return result;
+}
+
+/* the CPUs this process may run on, in order */
+static vector<int> allowed_cpus()
+{
+    vector<int> cpus;
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+static void pin_process(const vector<int>& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        CPU_SET(cpu, &set);
+
+    /* threads inherit the mask of their creator, so OpenCV's worker pool created afterwards stays on these CPUs too */
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        printf("Warning: failed to pin to the requested CPUs\n");
+}
+
+
+int main(int argc, char** argv)
+{
+    auto program_start = chrono::high_resolution_clock::now();
+
+    AppConfig config;
+    if (!parse_args(argc, argv, config))
+        return EXIT_FAILURE;
+    const ins::LUTOptions& options = config.options;
+
+    /* the pool has pinned its workers; the caller runs partition 0, so it takes the first CPU */
+    if (options.pool && !config.cpus.empty())
+        pin_process({ config.cpus[0] });
+    else if (!config.cpus.empty())
+        pin_process(config.cpus);
+
+    /* with [input], frames are warped where they were mapped and @image is not read */
+    unique_ptr<ins::FrameInput> input;
+    if (!config.input_spec.empty())
+    {
+        try
+        {
+            if (config.input_spec.compare(0, 4, "shm:") == 0)
+                input = ins::SharedFrameRing::open(config.input_spec.substr(4));
+            else
+                input = make_unique<ins::RawFrameFile>(config.input_spec.substr(4), config.input_size);
+        }
+        catch (const cv::Exception& e)
+        {
+            printf("Failed to open the input! : %s\n", e.what());
+            return EXIT_FAILURE;
+        }
+    }
+
+    Mat image = input ? Mat() : imread(config.image_path);
+    if (!input && image.empty())
+    {
+        printf("Failed to load the image!\n");
+        return EXIT_FAILURE;
+    }
+    Mat bgr_image = image;
+    Size image_size = input ? input->size() : image.size();
+
+    VideoCapture capture;
+    if (!config.stream_source.empty() && config.stream_source != "synthetic")
+    {
+        /* the video decides the source size; the still image is only used when the stream is synthetic */
+        if (!capture.open(config.stream_source) || !capture.read(bgr_image))
+        {
+            printf("Failed to open the stream! : %s\n", config.stream_source.c_str());
+            return EXIT_FAILURE;
+        }
+        image_size = bgr_image.size();
+    }
+
+    /* stands in for the camera or decoder, which deliver frames in this format */
+    if (!input)
+        convert_frame(bgr_image, image, options.format);
+
+    /* with [output], the screen is the display's back page and the display decides its size, stride and format */
+    unique_ptr<ins::FramebufferOutput> output;
+    if (!config.output_path.empty())
+    {
+        try
+        {
+            output = make_unique<ins::FramebufferOutput>(config.output_path, config.resolution, options.format, 2, config.stand_in);
+        }
+        catch (const cv::Exception& e)
+        {
+            printf("Failed to open the output! : %s\n", e.what());
+            return EXIT_FAILURE;
+        }
+        if (output->format() != options.format)
+        {
+            printf("The output takes %s pixels; use a format method with the matching [format]\n", ins::pixel_format_name(output->format()));
+            return EXIT_FAILURE;
+        }
+        config.resolution = output->size();
+        printf("%s\n", output->summary().c_str());
+    }
+
+    Mat screen = output ? output->back_mat() : create_screen(config.resolution, options.format);
+    uint* screen_buffer = reinterpret_cast<uint*>(screen.data);
+
+    /* the image keeps its own size; only the screen is set by [resolution] */
+    ins::Geometry geometry(image_size, config.resolution, input ? input->stride() : pixel_stride(image, options.format), pixel_stride(screen, options.format));
+
+    Mat trans_mat = ins::get_transform_matrix(config.corners, geometry.source);
+
+    /* [map] replaces the homography of the corners; [distortion] bends it with the radial lens model */
+    ins::Warp warp = trans_mat;
+    try
+    {
+        if (!config.map_path.empty())
+            warp = ins::Warp::load(config.map_path);
+        else if (config.distortion != Vec2d())
+            warp = ins::Warp::radial(trans_mat, geometry.screen, config.distortion[0], config.distortion[1]);
+    }
+    catch (const cv::Exception& e)
+    {
+        printf("Failed to load the warp! : %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    if (!config.map_path.empty() && warp.map_size() != geometry.screen)
+    {
+        printf("The map is %dx%d; set [resolution] to match\n", warp.map_size().width, warp.map_size().height);
+        return EXIT_FAILURE;
+    }
+    if (!warp.is_homography())
+        printf("Warp : %s\n", warp.summary().c_str());
+
+    const ins::LUTMethod* method = ins::find_lut_method(config.method);
+    if (!method)
+    {
+        printf("Unrecognizable method name! : %s\n", config.method.c_str());
+        return EXIT_FAILURE;
+    }
+    if (options.format != ins::PixelFormat::BGRA32 && !method->has(ins::LUTMethod::NATIVE_FORMATS))
+    {
+        printf("%s only supports [format]=bgra\n", config.method.c_str());
+        return EXIT_FAILURE;
+    }
+
+    /* offset and reverse tables are independent of the screen address, so they can be kept on disk */
+    uint64_t cache_key = ins::lut_cache_key(warp, geometry, options.format);
+    char cache_name[64];
+    snprintf(cache_name, sizeof(cache_name), "/%016llx-%u.lut", static_cast<unsigned long long>(cache_key), method->file_kind);
+    string cache_path = config.cache_dir + cache_name;
+
+    auto build_start = chrono::high_resolution_clock::now();
+    shared_ptr<ins::MappedLUTFile> cache_file = nullptr;
+    if (!config.cache_dir.empty() && method->file_kind != 0)
+        cache_file = ins::MappedLUTFile::open(cache_path, method->file_kind, cache_key, config.cache_flags);
+    bool loaded_from_cache = false;
+
+    unique_ptr<ins::LUT> lut;
+    if (cache_file)
+    {
+        /* a file that passes the header check but does not fit these frames is rebuilt and overwritten */
+        try
+        {
+            lut = method->load(cache_file, geometry, screen_buffer, options);
+            loaded_from_cache = true;
+        }
+        catch (const cv::Exception& e)
+        {
+            printf("Warning: the cached LUT does not fit, rebuilding : %s\n", e.what());
+        }
+    }
+    try
+    {
+        if (!lut)
+            lut = method->create(warp, geometry, screen_buffer, options);
+    }
+    catch (const cv::Exception& e)
+    {
+        printf("Failed to build the LUT! : %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    string generated_class_info = "LUT method : " + method->class_name;
+    auto build_end = chrono::high_resolution_clock::now();
+    printf("%s\n", generated_class_info.c_str());
+    printf("LUT %s took %lld ms, %lld us\n", loaded_from_cache ? "load" : "build",
+           static_cast<long long>(chrono::duration_cast<chrono::milliseconds>(build_end - build_start).count()),
+           static_cast<long long>(chrono::duration_cast<chrono::microseconds>(build_end - build_start).count()));
+    string summary = lut->summary();
+    if (!summary.empty())
+        printf("%s\n", summary.c_str());
+    if (options.pool)
+        printf("%s\n", options.pool->summary().c_str());
+
+    /* only what the load above can read back is saved; some methods derive from the tables without sharing their file kind */
+    if (!config.cache_dir.empty() && !loaded_from_cache)
+    {
+        auto offset_lut = dynamic_cast<ins::OffsetLUT*>(lut.get());
+        auto reverse_lut = dynamic_cast<ins::ReverseLUT*>(lut.get());
+        if (method->file_kind == ins::OffsetLUT::FILE_KIND && offset_lut)
+            offset_lut->save(cache_path, cache_key);
+        else if (method->file_kind == ins::ReverseLUT::FILE_KIND && reverse_lut)
+            reverse_lut->save(cache_path, cache_key);
+        else
+            printf("Warning: %s cannot be cached\n", config.method.c_str());
+    }
+
+    switch (config.mode)
+    {
+    case Mode::QUADS: return run_quads(config, *method, geometry, move(lut), image, screen);
+    case Mode::OUTPUT: return run_output(config, *method, warp, geometry, *lut, image, *output);
+    case Mode::STREAM: return run_stream(config, *lut, bgr_image, capture);
+    case Mode::ASYNC: return run_async(config, *lut, image, screen);
+    case Mode::RECALIBRATE: return run_recalibrate(config, *method, geometry, move(lut), image, input.get(), screen, program_start);
+    default: return run_frames(config, *lut, image, input.get(), screen, program_start);
+    }
+}
+
 
-bool parse_args(int argc, char** argv, 
-                string& lut_method, string& image_path, 
-                Point2f& tl, Point2f& tr, Point2f& br, Point2f& bl,
-                Size& resolution,
-                bool& no_gui,
-                int& repeat)
+bool parse_args(int argc, char** argv, AppConfig& config)
 {
     const string keys =
         "{h help     |         | print this message and exit. }"
@@ -117,21 +771,40 @@ bool parse_args(int argc, char** argv,
         "{@TR        |<none>   | desired coordinates of top-right corner. format: x,y }"
         "{@BR        |<none>   | desired coordinates of bottom-right corner. format: x,y }"
         "{@BL        |<none>   | desired coordinates of bottom-left corner. format: x,y }"
-        "{resolution |1920x1080| the size of screen. format: WxH }"
+        "{resolution |1920x1080| the size of screen; the image keeps its own size. format: WxH }"
         "{no-gui     |         | }"
-        "{repeat     |100      | the number of times to run the method. }";
+        "{repeat     |100      | the number of times to run the method. }"
+        "{span       |1        | incremental methods: pixels per projective division. }"
+        "{grid       |16       | mesh methods: screen pixels between the grid nodes that keep exact coordinates. }"
+        "{tile       |64x64    | tiled methods: the size of screen tiles; dirty-tiles: of source tiles. format: WxH }"
+        "{isa        |auto     | simd methods: auto, scalar, sse4.1, avx2 or avx512. }"
+        "{pool       |opencv   | parallel methods: opencv (cv::parallel_for_), or a persistent ins::ThreadPool with static or dynamic partitions. }"
+        "{cpus       |         | pin the app and its worker threads to these CPUs; a pool pins worker i to the i-th CPU the app may run on by default. format: 0,1,2,3 }"
+        "{cache      |         | directory of memory-mapped LUT files; offset and reverse methods only. }"
+        "{populate   |         | prefault the whole cached LUT at startup. }"
+        "{hugepages  |         | request huge pages for the cached LUT. }"
+        "{recalibrate|0        | mode: rebuild the LUT in the background every N frames and report frame-time jitter; 0 disables. }"
+        "{format     |bgra     | format methods: pixel format of the frames; bgra, bgr24, rgb565, gray8, nv12 or i420. }"
+        "{stream     |         | mode: run decode, warp and present as a pipeline on a video file, or on a generated stream with 'synthetic'; [repeat] is the frame limit. }"
+        "{depth      |3        | stream: preallocated frames per pipeline queue. }"
+        "{quads      |         | mode: composite more surfaces above the first quad in one pass, each above the previous. format: x,y,x,y,x,y,x,y;x,y,... }"
+        "{output     |         | mode: warp straight into a memory-mapped display: /dev/fbN, or a file (e.g. in /dev/shm) of [resolution] as a stand-in. }"
+        "{vsync      |         | output: wait for the vertical blank after each flip. }"
+        "{stand-in   |         | output: use a regular file as the display, creating or resizing it; needed for existing files and paths under /dev such as /dev/shm. }"
+        "{input      |         | warp BGRA frames in place from a mapped raw file (raw:<path>) or a shared-memory ring (shm:<name>, see frame_producer.out) instead of @image. }"
+        "{input-size |1920x1080| input: the size of the raw file's frames. format: WxH }"
+        "{counters   |         | read cycles, instructions, LLC and dTLB misses around every frame and every parallel partition (Linux perf_event_open). }"
+        "{map        |         | build the LUT from this warp map instead of the corners: a cv::FileStorage file with map_x and map_y, map_xy, or offsets and source_stride, of [resolution]. }"
+        "{distortion |         | bend the corners' homography with radial lens distortion about the screen centre. format: k1,k2 }"
+        "{async      |0        | mode: warp the next frame on a background thread while the previous one is presented, into a ring of N screens, and compare with the synchronous loop; 0 disables. }";
 
     CommandLineParser parser(argc, argv, keys);
     parser.about(
         "Run a performance assessment of perspective transform using LUT.\n"
+        "Options marked 'mode' each run their own loop and cannot be combined.\n"
         "\n"
         "Following methods are currently available:\n"
-        "        plain           plain 1D LUT with for-loop\n"
-        "        parallel        multi-threaded for-loop; each thread applies LUT on their sub-region\n"
-#ifdef __arm__
-        "        plain-o1        plain 1D LUT with general purpose registers and LDM STM instructions\n"
-        "        parallel-o1     multi-threaded optimized for-loop; same optimization scheme as plain-o1\n"
-#endif
+        + ins::lut_methods_help()
     );
 
     if (parser.has("help"))
@@ -140,61 +813,271 @@ bool parse_args(int argc, char** argv,
         return false;
     }
 
-    lut_method = parser.get<string>("@method");
-    image_path = parser.get<string>("@image");
+    config.method = parser.get<string>("@method");
+    config.image_path = parser.get<string>("@image");
 
     regex coordinates_pattern(R"~((\d+),(\d+))~");
     smatch matches;
+    string tmps;
 
-    string tmps = parser.get<string>("@TL");
-    if (regex_match(tmps, matches, coordinates_pattern))
-        tl = Point2f(stoi(matches[1].str()), stoi(matches[2].str()));
+    config.corners.clear();
+    for (const char* corner : { "@TL", "@TR", "@BR", "@BL" })
+    {
+        tmps = parser.get<string>(corner);
+        if (!regex_match(tmps, matches, coordinates_pattern))
+        {
+            printf("Error: failed to parse %s=%s\n", corner, tmps.c_str());
+            return false;
+        }
+        config.corners.push_back(Point2f(stoi(matches[1].str()), stoi(matches[2].str())));
+    }
+
+    regex resolution_pattern(R"~((\d+)[x|X](\d+))~");
+    tmps = parser.get<string>("resolution");
+    if (regex_match(tmps, matches, resolution_pattern))
+        config.resolution = Size(stoi(matches[1].str()), stoi(matches[2].str()));
     else
     {
-        printf("Error: failed to parse @TL=%s\n", tmps.c_str());
+        printf("Error: failed to parse [resolution]=%s\n", tmps.c_str());
         return false;
     }
 
-    tmps = parser.get<string>("@TR");
-    if (regex_match(tmps, matches, coordinates_pattern))
-        tr = Point2f(stoi(matches[1].str()), stoi(matches[2].str()));
+    ins::LUTOptions& options = config.options;
+    tmps = parser.get<string>("tile");
+    if (regex_match(tmps, matches, resolution_pattern) && stoi(matches[1].str()) > 0 && stoi(matches[2].str()) > 0)
+        options.tile_size = Size(stoi(matches[1].str()), stoi(matches[2].str()));
     else
     {
-        printf("Error: failed to parse @TR=%s\n", tmps.c_str());
+        printf("Error: failed to parse [tile]=%s\n", tmps.c_str());
         return false;
     }
 
-    tmps = parser.get<string>("@BR");
-    if (regex_match(tmps, matches, coordinates_pattern))
-        br = Point2f(stoi(matches[1].str()), stoi(matches[2].str()));
+    tmps = parser.get<string>("isa");
+    if (tmps == "auto")
+        options.isa = ins::detect_simd_isa();
+    else if (tmps == "scalar")
+        options.isa = ins::SimdISA::SCALAR;
+    else if (tmps == "sse4.1")
+        options.isa = ins::SimdISA::SSE41;
+    else if (tmps == "avx2")
+        options.isa = ins::SimdISA::AVX2;
+    else if (tmps == "avx512")
+        options.isa = ins::SimdISA::AVX512;
     else
     {
-        printf("Error: failed to parse @BR=%s\n", tmps.c_str());
+        printf("Error: failed to parse [isa]=%s\n", tmps.c_str());
+        return false;
+    }
+    if (options.isa > ins::detect_simd_isa())
+    {
+        printf("Error: this CPU does not support [isa]=%s\n", tmps.c_str());
+        return false;
+    }
+
+    config.cpus.clear();
+    tmps = parser.get<string>("cpus");
+    if (!tmps.empty())
+    {
+        stringstream cpus(tmps);
+        string cpu;
+        while (getline(cpus, cpu, ','))
+        {
+            if (!regex_match(cpu, regex(R"~(\d+)~")) || stoi(cpu) >= CPU_SETSIZE)
+            {
+                printf("Error: failed to parse [cpus]=%s\n", tmps.c_str());
+                return false;
+            }
+            config.cpus.push_back(stoi(cpu));
+        }
+    }
+
+    tmps = parser.get<string>("pool");
+    if (tmps == "static" || tmps == "dynamic")
+    {
+        if (config.cpus.empty())
+            config.cpus = allowed_cpus();
+        options.pool = make_shared<ins::ThreadPool>(getNumThreads(), config.cpus,
+                                                    tmps == "static" ? ins::ThreadPool::Schedule::STATIC : ins::ThreadPool::Schedule::DYNAMIC);
+    }
+    else if (tmps != "opencv")
+    {
+        printf("Error: failed to parse [pool]=%s\n", tmps.c_str());
         return false;
     }
 
-    tmps = parser.get<string>("@BL");
-    if (regex_match(tmps, matches, coordinates_pattern))
-        bl = Point2f(stoi(matches[1].str()), stoi(matches[2].str()));
+    tmps = parser.get<string>("format");
+    if (tmps == "bgra")
+        options.format = ins::PixelFormat::BGRA32;
+    else if (tmps == "bgr24")
+        options.format = ins::PixelFormat::BGR24;
+    else if (tmps == "rgb565")
+        options.format = ins::PixelFormat::RGB565;
+    else if (tmps == "gray8")
+        options.format = ins::PixelFormat::GRAY8;
+    else if (tmps == "nv12")
+        options.format = ins::PixelFormat::NV12;
+    else if (tmps == "i420")
+        options.format = ins::PixelFormat::I420;
     else
     {
-        printf("Error: failed to parse @BL=%s\n", tmps.c_str());
+        printf("Error: failed to parse [format]=%s\n", tmps.c_str());
         return false;
     }
 
-    regex resolution_pattern(R"~((\d+)[x|X](\d+))~");
-    tmps = parser.get<string>("resolution");
-    if (regex_match(tmps, matches, resolution_pattern))
-        resolution = Size(stoi(matches[1].str()), stoi(matches[2].str()));
+    if (parser.has("counters"))
+        options.profiler = make_shared<ins::LUTProfiler>();
+
+    config.cache_dir = parser.get<string>("cache");
+    config.cache_flags = 0;
+    if (parser.has("populate"))
+        config.cache_flags |= ins::MappedLUTFile::POPULATE;
+    if (parser.has("hugepages"))
+        config.cache_flags |= ins::MappedLUTFile::HUGEPAGES;
+
+    config.recalibrate_every = parser.get<int>("recalibrate");
+
+    config.stream_source = parser.get<string>("stream");
+    config.stream_depth = parser.get<int>("depth");
+    if (!config.stream_source.empty() && config.stream_depth < 1)
+    {
+        printf("Error: [depth] must be positive, got %d\n", config.stream_depth);
+        return false;
+    }
+
+    config.extra_quads.clear();
+    tmps = parser.get<string>("quads");
+    if (!tmps.empty())
+    {
+        regex quad_pattern(R"~((\d+),(\d+),(\d+),(\d+),(\d+),(\d+),(\d+),(\d+))~");
+        stringstream quads(tmps);
+        string quad;
+        while (getline(quads, quad, ';'))
+        {
+            if (!regex_match(quad, matches, quad_pattern))
+            {
+                printf("Error: failed to parse [quads]=%s\n", tmps.c_str());
+                return false;
+            }
+            vector<Point2f> corners;
+            for (int i = 0; i < 4; i++)
+                corners.push_back(Point2f(stoi(matches[2 * i + 1].str()), stoi(matches[2 * i + 2].str())));
+            config.extra_quads.push_back(corners);
+        }
+    }
+
+    config.output_path = parser.get<string>("output");
+    config.vsync = parser.has("vsync");
+    config.stand_in = parser.has("stand-in");
+
+    config.input_spec = parser.get<string>("input");
+    if (!config.input_spec.empty() && config.input_spec.compare(0, 4, "raw:") != 0 && config.input_spec.compare(0, 4, "shm:") != 0)
+    {
+        printf("Error: failed to parse [input]=%s\n", config.input_spec.c_str());
+        return false;
+    }
+    tmps = parser.get<string>("input-size");
+    if (regex_match(tmps, matches, resolution_pattern) && stoi(matches[1].str()) > 0 && stoi(matches[2].str()) > 0)
+        config.input_size = Size(stoi(matches[1].str()), stoi(matches[2].str()));
     else
     {
-        printf("Error: failed to parse [resolution]=%s\n", tmps.c_str());
+        printf("Error: failed to parse [input-size]=%s\n", tmps.c_str());
+        return false;
+    }
+
+    config.no_gui = parser.has("no-gui");
+
+    config.repeat = parser.get<int>("repeat");
+    if (config.repeat < 1)
+    {
+        printf("Error: [repeat] must be positive, got %d\n", config.repeat);
+        return false;
+    }
+
+    options.span = parser.get<int>("span");
+    if (options.span < 1)
+    {
+        printf("Error: [span] must be positive, got %d\n", options.span);
         return false;
     }
 
-    no_gui = parser.has("no-gui");
+    options.grid = parser.get<int>("grid");
+    if (options.grid < 1)
+    {
+        printf("Error: [grid] must be positive, got %d\n", options.grid);
+        return false;
+    }
+
+    config.map_path = parser.get<string>("map");
+    tmps = parser.get<string>("distortion");
+    config.distortion = Vec2d();
+    if (!tmps.empty())
+    {
+        if (!regex_match(tmps, matches, regex(R"~(([-+]?\d*\.?\d+),([-+]?\d*\.?\d+))~")))
+        {
+            printf("Error: failed to parse [distortion]=%s\n", tmps.c_str());
+            return false;
+        }
+        config.distortion = Vec2d(stod(matches[1].str()), stod(matches[2].str()));
+    }
+    bool custom_warp = !config.map_path.empty() || !tmps.empty();
+    if (!config.map_path.empty() && !tmps.empty())
+    {
+        printf("Error: [map] and [distortion] cannot be combined\n");
+        return false;
+    }
+
+    config.async_depth = parser.get<int>("async");
+    if (config.async_depth < 0 || config.async_depth == 1)
+    {
+        printf("Error: [async] needs at least 2 screens, one presented while the other is warped, got %d\n", config.async_depth);
+        return false;
+    }
+
+    /* what each mode runs on: [input] frames, a [format] other than bgra, and a warp that is not the corners' homography */
+    struct ModeOption
+    {
+        Mode mode;
+        const char* name;
+        bool selected;
+        bool takes_input, takes_format, takes_warp;
+    };
+    const ModeOption modes[] = {
+        { Mode::STILL,       "",              true,                              true,  true,  true  },
+        { Mode::QUADS,       "[quads]",       !config.extra_quads.empty(),       false, false, false },
+        { Mode::OUTPUT,      "[output]",      !config.output_path.empty(),       false, true,  true  },
+        { Mode::STREAM,      "[stream]",      !config.stream_source.empty(),     false, true,  true  },
+        { Mode::ASYNC,       "[async]",       config.async_depth > 0,            false, true,  true  },
+        { Mode::RECALIBRATE, "[recalibrate]", config.recalibrate_every > 0,      true,  true,  false },
+    };
+    const ModeOption* mode = &modes[0];
+    for (const ModeOption& option : modes)
+    {
+        if (!option.selected || option.mode == Mode::STILL)
+            continue;
+        if (mode->mode != Mode::STILL)
+        {
+            printf("Error: %s and %s cannot be combined; each runs its own loop\n", mode->name, option.name);
+            return false;
+        }
+        mode = &option;
+    }
+    config.mode = mode->mode;
 
-    repeat = parser.get<int>("repeat");
+    if (!config.input_spec.empty() && (!mode->takes_input || options.format != ins::PixelFormat::BGRA32))
+    {
+        printf("Error: [input] maps BGRA frames and cannot be combined with %s\n", mode->takes_input ? "[format]" : mode->name);
+        return false;
+    }
+    if (options.format != ins::PixelFormat::BGRA32 && !mode->takes_format)
+    {
+        printf("Error: %s only supports [format]=bgra\n", mode->name);
+        return false;
+    }
+    if (custom_warp && !mode->takes_warp)
+    {
+        printf("Error: [map] and [distortion] cannot be combined with %s, which builds from corners\n", mode->name);
+        return false;
+    }
 
     if (!parser.check())
     {
@@ -203,4 +1086,77 @@ bool parse_args(int argc, char** argv,
     }
 
     return true;
-}
\ No newline at end of file
+}
+
+
+void convert_frame(const Mat& bgr_image, Mat& frame, ins::PixelFormat format)
+{
+    switch (format)
+    {
+    case ins::PixelFormat::BGR24:
+        bgr_image.copyTo(frame);
+        break;
+    case ins::PixelFormat::RGB565:
+        cvtColor(bgr_image, frame, COLOR_BGR2BGR565);
+        break;
+    case ins::PixelFormat::GRAY8:
+        cvtColor(bgr_image, frame, COLOR_BGR2GRAY);
+        break;
+    case ins::PixelFormat::I420:
+        cvtColor(bgr_image, frame, COLOR_BGR2YUV_I420);
+        break;
+    case ins::PixelFormat::NV12:
+    {
+        /* same luma plane as I420; the U and V planes are interleaved into one */
+        Mat i420;
+        cvtColor(bgr_image, i420, COLOR_BGR2YUV_I420);
+        frame.create(i420.rows, i420.cols, CV_8UC1);
+        int luma_size = bgr_image.cols * bgr_image.rows;
+        int chroma_size = luma_size / 4;
+        memcpy(frame.data, i420.data, luma_size);
+        const uchar* u = i420.data + luma_size;
+        const uchar* v = u + chroma_size;
+        uchar* uv = frame.data + luma_size;
+        for (int i = 0; i < chroma_size; i++)
+        {
+            uv[2 * i] = u[i];
+            uv[2 * i + 1] = v[i];
+        }
+        break;
+    }
+    default:
+        cvtColor(bgr_image, frame, COLOR_BGR2BGRA);
+        break;
+    }
+}
+
+Mat create_screen(Size resolution, ins::PixelFormat format)
+{
+    switch (format)
+    {
+    case ins::PixelFormat::BGR24: return Mat::zeros(resolution.height, resolution.width, CV_8UC3);
+    case ins::PixelFormat::RGB565: return Mat::zeros(resolution.height, resolution.width, CV_8UC2);
+    case ins::PixelFormat::GRAY8: return Mat::zeros(resolution.height, resolution.width, CV_8UC1);
+    case ins::PixelFormat::NV12:
+    case ins::PixelFormat::I420: return Mat::zeros(resolution.height * 3 / 2, resolution.width, CV_8UC1);
+    default: return Mat::zeros(resolution.height, resolution.width, CV_8UC4);
+    }
+}
+
+Mat display_frame(const Mat& screen, ins::PixelFormat format)
+{
+    Mat bgr;
+    switch (format)
+    {
+    case ins::PixelFormat::RGB565: cvtColor(screen, bgr, COLOR_BGR5652BGR); return bgr;
+    case ins::PixelFormat::NV12: cvtColor(screen, bgr, COLOR_YUV2BGR_NV12); return bgr;
+    case ins::PixelFormat::I420: cvtColor(screen, bgr, COLOR_YUV2BGR_I420); return bgr;
+    default: return screen;
+    }
+}
+
+/* row stride of the packed frame or of the luma plane, in pixels */
+int pixel_stride(const Mat& frame, ins::PixelFormat format)
+{
+    return static_cast<int>(ins::is_planar_yuv(format) ? frame.step1() : frame.step1() / frame.channels());
+}
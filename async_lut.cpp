@@ -0,0 +1,80 @@
+#include "async_lut.hpp"
+
+
+namespace ins
+{
+
+
+AsyncLUT::AsyncLUT(RelocatableLUT& lut)
+    : lut(lut)
+{
+    worker = thread(&AsyncLUT::warp_loop, this);
+}
+
+AsyncLUT::~AsyncLUT()
+{
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_changed.notify_all();
+    worker.join();
+}
+
+future<void> AsyncLUT::apply_async(const uint* image_data, uint* screen, Completion completion)
+{
+    CV_Assert(image_data && screen);
+
+    Request request = { image_data, screen, move(completion), promise<void>() };
+    future<void> result = request.done.get_future();
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        if (stopping)
+            CV_Error(Error::StsError, "the async LUT is shutting down");
+        requests.push_back(move(request));
+    }
+    queue_changed.notify_one();
+    return result;
+}
+
+int AsyncLUT::pending() const
+{
+    lock_guard<mutex> lock(queue_mutex);
+    return static_cast<int>(requests.size()) + (running ? 1 : 0);
+}
+
+void AsyncLUT::warp_loop()
+{
+    unique_lock<mutex> lock(queue_mutex);
+
+    while (true)
+    {
+        queue_changed.wait(lock, [&]{ return stopping || !requests.empty(); });
+        /* the queue is drained before stopping, so no future is left without a value */
+        if (requests.empty())
+            break;
+
+        Request request = move(requests.front());
+        requests.pop_front();
+        running = true;
+        lock.unlock();
+
+        try
+        {
+            lut.apply(request.image_data, request.screen);
+            if (request.completion)
+                request.completion(request.screen);
+            request.done.set_value();
+        }
+        catch (...)
+        {
+            request.done.set_exception(current_exception());
+        }
+
+        lock.lock();
+        running = false;
+    }
+}
+
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <opencv2/core.hpp>
+
+#include "common.hpp"
+
+using namespace std;
+using namespace cv;
+
+
+namespace ins
+{
+
+
+/* Runs the applies of a relocatable LUT on a dedicated thread, so the caller can present one frame while the next is warped.
+ * apply_async() queues a warp of image_data into screen and returns at once; the future becomes ready when the screen holds
+ * the frame, or carries the exception apply() threw. Warps run in submission order, and the image and screen must be left
+ * alone until their future is ready, so a caller keeps a ring of screens and presents the oldest finished one.
+ * The LUT must not be applied from anywhere else meanwhile; its thread pool is not reentrant.
+ */
+class AsyncLUT
+{
+public:
+    /* runs on the warp thread once the screen is complete, before the future becomes ready; it must not block */
+    typedef function<void(uint* screen)> Completion;
+
+    explicit AsyncLUT(RelocatableLUT& lut);
+    ~AsyncLUT();    // finishes the queued warps
+
+    future<void> apply_async(const uint* image_data, uint* screen, Completion completion = nullptr);
+
+    int pending() const;    // queued warps, including the one running
+    RelocatableLUT& target() const { return lut; }
+
+private:
+    struct Request
+    {
+        const uint* image_data;
+        uint* screen;
+        Completion completion;
+        promise<void> done;
+    };
+
+    RelocatableLUT& lut;
+
+    mutable mutex queue_mutex;
+    condition_variable queue_changed;
+    deque<Request> requests;
+    bool running = false;
+    bool stopping = false;
+    thread worker;
+
+    void warp_loop();
+};
+
+
+}
@@ -0,0 +1,831 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <regex>
+#include <sstream>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "common.hpp"
+#include "dirty_tiles.hpp"
+#include "lut_methods.hpp"
+#include "perf_counters.hpp"
+#include "thread_pool.hpp"
+
+using namespace std;
+using namespace cv;
+
+
+struct BenchmarkConfig
+{
+    vector<string> methods;
+    vector<Point2f> corners;
+    Size source;
+    Size resolution;
+    int warmup;
+    int iterations;
+    int threads;
+    vector<int> cpus;
+    vector<string> backends;
+    ins::LUTOptions options;
+    string csv_path;
+    string json_path;
+    bool dirty;
+    bool counters;
+    vector<int> grids;
+    string map_path;
+    Vec2d distortion;
+    bool remap;
+    vector<int> batches;
+};
+
+struct BenchmarkResult
+{
+    string name;
+    string class_name;
+    string reference;
+    double min_us, median_us, p99_us, mean_us, stddev_us;
+    double gigabytes_per_second;
+    long long mismatches;    // pixels that differ from the reference, -1 if the method could not be built
+    bool has_counters;
+    ins::PerfSample counters;   // per frame, summed over threads
+};
+
+
+bool parse_args(int argc, char** argv, BenchmarkConfig& config);
+
+
+/* Deterministic, high-entropy frame, so a pixel copied from the wrong place cannot match by accident
+ */
+static Mat make_frame(Size size)
+{
+    Mat frame(size.height, size.width, CV_8UC4);
+    for (int y = 0; y < size.height; y++)
+    {
+        uint* row = reinterpret_cast<uint*>(frame.ptr(y));
+        for (int x = 0; x < size.width; x++)
+            row[x] = static_cast<uint>(y * size.width + x) * 2654435761u;
+    }
+    return frame;
+}
+
+/* Scatter tables keep the screen pixel of the last source pixel, gather tables sample the screen pixel's
+ * own source, so each family is compared against its plain implementation rather than all against PlainLUT.
+ */
+static const char* reference_method(const ins::LUT* lut, const ins::LUTOptions& options)
+{
+    if (dynamic_cast<const ins::BilinearLUT*>(lut))
+        return "plain-bilinear";
+    if (dynamic_cast<const ins::MeshLUT*>(lut))
+        return nullptr;     // interpolated between grid nodes; --grids reports the error instead
+    if (dynamic_cast<const ins::IncrementalLUT*>(lut))
+        return options.span == 1 ? "plain-reverse" : nullptr;    // interpolated coordinates are approximate
+    if (dynamic_cast<const ins::ReverseLUT*>(lut) || dynamic_cast<const ins::FormatLUT*>(lut))
+        return "plain-reverse";
+    return "plain";
+}
+
+static Mat render(const ins::LUTMethod& method, const ins::Warp& warp, const ins::Geometry& geometry,
+                  const ins::LUTOptions& options, const Mat& frame)
+{
+    Mat screen = Mat::zeros(geometry.screen.height, geometry.screen.width, CV_8UC4);
+    unique_ptr<ins::LUT> lut = method.create(warp, geometry, reinterpret_cast<uint*>(screen.data), options);
+    lut->apply(reinterpret_cast<const uint*>(frame.data));
+    return screen;
+}
+
+static double median(vector<double> samples)
+{
+    sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+/* Runs apply [warmup] times untimed and [iterations] times timed, and fills in the timing figures of the result
+ */
+static void measure(const BenchmarkConfig& config, const function<void()>& apply, BenchmarkResult& result)
+{
+    for (int i = 0; i < config.warmup; i++)
+        apply();
+
+    vector<double> samples(config.iterations);
+    for (int i = 0; i < config.iterations; i++)
+    {
+        auto start = chrono::steady_clock::now();
+        apply();
+        auto end = chrono::steady_clock::now();
+        samples[i] = chrono::duration<double, micro>(end - start).count();
+    }
+
+    sort(samples.begin(), samples.end());
+    double sum = 0, squares = 0;
+    for (double t : samples)
+        sum += t;
+    result.mean_us = sum / samples.size();
+    for (double t : samples)
+        squares += (t - result.mean_us) * (t - result.mean_us);
+    result.stddev_us = sqrt(squares / samples.size());
+    result.min_us = samples.front();
+    result.median_us = samples[samples.size() / 2];
+    result.p99_us = samples[min(samples.size() - 1, static_cast<size_t>(ceil(samples.size() * 0.99)) - 1)];
+    result.gigabytes_per_second = static_cast<double>(config.source.area() + config.resolution.area()) * sizeof(uint) / (result.median_us * 1e3);
+}
+
+static void print_result(const BenchmarkResult& result, const string& check)
+{
+    printf("%-30s min %9.1f  median %9.1f  p99 %9.1f  stddev %8.1f us  %6.2f GB/s  %s\n",
+           result.name.c_str(), result.min_us, result.median_us, result.p99_us, result.stddev_us,
+           result.gigabytes_per_second, check.c_str());
+}
+
+/* Repaints a rectangle with content that moves by 4 pixels per frame, like a scrolling ticker
+ */
+static void paint(Mat& frame, Rect area, int frame_index)
+{
+    for (int y = area.y; y < area.y + area.height; y++)
+    {
+        uint* row = reinterpret_cast<uint*>(frame.ptr(y));
+        for (int x = area.x; x < area.x + area.width; x++)
+            row[x] = static_cast<uint>(y * frame.cols + x + 4 * (frame_index + 1)) * 2654435761u;
+    }
+}
+
+/* Times TileDiffer + DirtyTileLUT::apply_dirty against a full warp of every frame for update patterns typical
+ * of signage content, and checks that the incrementally updated screen ends up identical to the fully warped one.
+ */
+static bool run_dirty_patterns(const BenchmarkConfig& config, const ins::Warp& warp, const ins::Geometry& geometry)
+{
+    const Size& source = config.source;
+    Rect whole(Point(0, 0), source);
+    const pair<const char*, vector<Rect>> patterns[] = {
+        { "static", {} },
+        { "clock", { Rect(source.width - 200, 40, 160, 80) & whole } },
+        { "ticker", { Rect(0, source.height - 96, source.width, 96) & whole } },
+        { "inset+clock", { Rect(source.width / 16, source.height / 8, source.width / 3, source.height / 3) & whole,
+                           Rect(source.width - 200, 40, 160, 80) & whole } },
+        { "full", { whole } },
+    };
+
+    Mat full_screen = Mat::zeros(config.resolution.height, config.resolution.width, CV_8UC4);
+    Mat dirty_screen = Mat::zeros(config.resolution.height, config.resolution.width, CV_8UC4);
+    ins::DirtyTileLUT lut(warp, geometry, reinterpret_cast<uint*>(full_screen.data), config.options.tile_size);
+    printf("\nDirty-tile updates (%s)\n", lut.summary().c_str());
+
+    bool all_exact = true;
+    for (const auto& pattern : patterns)
+    {
+        Mat frame = make_frame(source);
+        const uint* image_data = reinterpret_cast<const uint*>(frame.data);
+        uint* full_data = reinterpret_cast<uint*>(full_screen.data);
+        uint* dirty_data = reinterpret_cast<uint*>(dirty_screen.data);
+
+        /* the first diff marks the whole frame dirty, which primes both screens with the same picture */
+        ins::TileDiffer differ(source, source.width, config.options.tile_size);
+        lut.apply(image_data, full_data);
+        lut.apply_dirty(image_data, dirty_data, differ.diff(image_data));
+
+        vector<double> full_us(config.iterations), dirty_us(config.iterations), diff_us(config.iterations);
+        double dirty_area = 0, written = 0;
+        for (int i = 0; i < config.iterations; i++)
+        {
+            for (const Rect& area : pattern.second)
+                paint(frame, area, i);
+
+            auto start = chrono::steady_clock::now();
+            lut.apply(image_data, full_data);
+            auto full_end = chrono::steady_clock::now();
+            const vector<Rect>& dirty = differ.diff(image_data);
+            auto diff_end = chrono::steady_clock::now();
+            written += lut.apply_dirty(image_data, dirty_data, dirty);
+            auto dirty_end = chrono::steady_clock::now();
+
+            full_us[i] = chrono::duration<double, micro>(full_end - start).count();
+            diff_us[i] = chrono::duration<double, micro>(diff_end - full_end).count();
+            dirty_us[i] = chrono::duration<double, micro>(dirty_end - full_end).count();
+            for (const Rect& area : dirty)
+                dirty_area += area.area();
+        }
+
+        long long mismatches = 0;
+        for (int i = 0; i < geometry.screen_buffer_size(); i++)
+            mismatches += full_data[i] != dirty_data[i];
+        all_exact = all_exact && mismatches == 0;
+
+        double full = median(full_us), incremental = median(dirty_us);
+        printf("%-12s source dirty %5.1f%%  screen rewarped %5.1f%%  full %9.1f us  dirty %9.1f us (diff %8.1f us)  %6.1fx  %s\n",
+               pattern.first, 100. * dirty_area / config.iterations / source.area(),
+               100. * written / config.iterations / config.resolution.area(),
+               full, incremental, median(diff_us), full / incremental,
+               mismatches == 0 ? "matches full warp" : ("MISMATCH: " + to_string(mismatches) + " pixels").c_str());
+    }
+    return all_exact;
+}
+
+/* Times the parallel mesh gather for each grid size against the full gather table and reports how far the
+ * interpolated coordinates stray from the exact ones.
+ */
+static void run_mesh_grids(const BenchmarkConfig& config, const ins::Warp& warp, const ins::Geometry& geometry)
+{
+    Mat frame = make_frame(config.source);
+    const uint* image_data = reinterpret_cast<const uint*>(frame.data);
+    Mat screen = Mat::zeros(config.resolution.height, config.resolution.width, CV_8UC4);
+    uint* screen_data = reinterpret_cast<uint*>(screen.data);
+
+    auto time_apply = [&](ins::LUT& lut) {
+        for (int i = 0; i < config.warmup; i++)
+            lut.apply(image_data);
+        vector<double> samples(config.iterations);
+        for (int i = 0; i < config.iterations; i++)
+        {
+            auto start = chrono::steady_clock::now();
+            lut.apply(image_data);
+            samples[i] = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        }
+        return median(samples);
+    };
+
+    ins::ParallelReverseLUT reverse(warp, geometry, screen_data);
+    printf("\nMesh grids (parallel-mesh against parallel-reverse)\n");
+    printf("%-10s table %10.1f KB                 exact                                                 median %9.1f us\n",
+           "full", geometry.screen_buffer_size() * sizeof(uint32_t) / 1024., time_apply(reverse));
+
+    for (int grid : config.grids)
+    {
+        ins::ParallelMeshLUT mesh(warp, geometry, screen_data, grid);
+        ins::MeshLUT::Error error = mesh.error();
+        printf("grid %-5d table %10.1f KB (%6.1fx smaller)  error mean %6.3f px  max %7.3f px  mismatched %6.2f%%  median %9.1f us\n",
+               grid, mesh.table_bytes() / 1024., static_cast<double>(geometry.screen_buffer_size()) * sizeof(uint32_t) / mesh.table_bytes(),
+               error.mean_px, error.max_px, 100. * error.mismatched, time_apply(mesh));
+    }
+}
+
+/* Times cv::remap on the same map the LUTs are built from: nearest and bilinear on the float map, and on the
+ * fixed-point map convertMaps makes, which is OpenCV's fast path. Nearest is compared with plain-reverse; OpenCV
+ * rounds halves to even where the tables round them away from zero, so a few pixels may differ.
+ */
+static void run_remap(const BenchmarkConfig& config, const ins::Warp& warp, const ins::Geometry& geometry, vector<BenchmarkResult>& results)
+{
+    Mat frame = make_frame(config.source);
+    Mat map = warp.source_points(geometry.screen);
+    Mat fixed_map, fixed_weights;
+    convertMaps(map, Mat(), fixed_map, fixed_weights, CV_16SC2);
+    Mat expected = render(*ins::find_lut_method("plain-reverse"), warp, geometry, config.options, frame);
+
+    struct Variant
+    {
+        const char* name;
+        Mat map_1;
+        Mat map_2;
+        int interpolation;
+    };
+    const Variant variants[] = {
+        { "cv::remap-nearest", map, Mat(), INTER_NEAREST },
+        { "cv::remap-nearest-fixed", fixed_map, fixed_weights, INTER_NEAREST },
+        { "cv::remap-linear", map, Mat(), INTER_LINEAR },
+        { "cv::remap-linear-fixed", fixed_map, fixed_weights, INTER_LINEAR },
+    };
+
+    printf("\ncv::remap on the same map (%s)\n", warp.summary().c_str());
+    for (const Variant& variant : variants)
+    {
+        BenchmarkResult result = { variant.name, "cv::remap", "-", 0, 0, 0, 0, 0, 0, 0, false, {} };
+        Mat screen = Mat::zeros(geometry.screen.height, geometry.screen.width, CV_8UC4);
+        measure(config, [&]{ remap(frame, screen, variant.map_1, variant.map_2, variant.interpolation, BORDER_CONSTANT); }, result);
+
+        string check = "unchecked (other weights than plain-bilinear)";
+        if (variant.interpolation == INTER_NEAREST)
+        {
+            result.reference = "plain-reverse";
+            const uint* e = reinterpret_cast<const uint*>(expected.data);
+            const uint* a = reinterpret_cast<const uint*>(screen.data);
+            for (size_t i = 0; i < expected.total(); i++)
+                result.mismatches += e[i] != a[i];
+            check = "differs from plain-reverse in " + to_string(result.mismatches) + " pixels";
+        }
+        print_result(result, check);
+        results.push_back(result);
+    }
+}
+
+/* Times apply_batch for each batch size and reports the cost per frame, and checks that every frame of the largest
+ * batch matches the same frame warped on its own
+ */
+static bool run_batches(const BenchmarkConfig& config, const ins::Warp& warp, const ins::Geometry& geometry)
+{
+    int max_batch = *max_element(config.batches.begin(), config.batches.end());
+    vector<Mat> frames, screens;
+    vector<const uint*> images;
+    vector<uint*> screen_data;
+    for (int k = 0; k < max_batch; k++)
+    {
+        /* distinct content per frame, so a frame written into another frame's screen is caught */
+        Mat frame = make_frame(config.source);
+        uint* pixels = reinterpret_cast<uint*>(frame.data);
+        for (size_t i = 0; i < frame.total(); i++)
+            pixels[i] ^= static_cast<uint>(k + 1) * 0x9E3779B9u;
+        frames.push_back(frame);
+        images.push_back(pixels);
+        screens.push_back(Mat::zeros(config.resolution.height, config.resolution.width, CV_8UC4));
+        screen_data.push_back(reinterpret_cast<uint*>(screens.back().data));
+    }
+
+    printf("\nBatched apply (median us per frame; in brackets against batch 1)\n%-24s", "method");
+    for (int batch : config.batches)
+        printf("  %16s", ("batch " + to_string(batch)).c_str());
+    printf("\n");
+
+    bool all_exact = true;
+    for (const string& name : config.methods)
+    {
+        const ins::LUTMethod* method = ins::find_lut_method(name);
+        unique_ptr<ins::LUT> lut;
+        try
+        {
+            lut = method->create(warp, geometry, screen_data[0], config.options);
+        }
+        catch (const cv::Exception& e)
+        {
+            printf("%-24s  could not be built: %s\n", name.c_str(), e.what());
+            continue;
+        }
+        auto relocatable = dynamic_cast<ins::RelocatableLUT*>(lut.get());
+        if (!relocatable)
+            continue;
+
+        printf("%-24s", name.c_str());
+        double single_us = 0;
+        for (int batch : config.batches)
+        {
+            BenchmarkResult result = {};
+            measure(config, [&]{ relocatable->apply_batch(images.data(), screen_data.data(), batch); }, result);
+            double frame_us = result.median_us / batch;
+            if (batch == 1)
+                single_us = frame_us;
+            char cell[32];
+            if (single_us > 0)
+                snprintf(cell, sizeof(cell), "%8.1f (%4.2fx)", frame_us, frame_us / single_us);
+            else
+                snprintf(cell, sizeof(cell), "%8.1f", frame_us);
+            printf("  %16s", cell);
+        }
+
+        /* scatter methods leave unmapped pixels untouched, so both sides start from cleared screens */
+        for (Mat& screen : screens)
+            screen.setTo(Scalar(0));
+        relocatable->apply_batch(images.data(), screen_data.data(), max_batch);
+        Mat single = Mat::zeros(config.resolution.height, config.resolution.width, CV_8UC4);
+        long long mismatches = 0;
+        for (int k = 0; k < max_batch; k++)
+        {
+            single.setTo(Scalar(0));
+            relocatable->apply(images[k], reinterpret_cast<uint*>(single.data));
+            const uint* e = reinterpret_cast<const uint*>(single.data);
+            const uint* a = screen_data[k];
+            for (size_t i = 0; i < single.total(); i++)
+                mismatches += e[i] != a[i];
+        }
+        /* a parallel scatter may resolve contested screen pixels differently from run to run */
+        bool racy = method->has(ins::LUTMethod::RACY_SCATTER);
+        if (mismatches == 0)
+            printf("  matches single frames\n");
+        else if (racy)
+            printf("  %lld contested pixels differ from single frames\n", mismatches);
+        else
+            printf("  MISMATCH against single frames: %lld pixels\n", mismatches);
+        all_exact = all_exact && (mismatches == 0 || racy);
+    }
+    return all_exact;
+}
+
+static void pin_process(const vector<int>& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        CPU_SET(cpu, &set);
+
+    /* threads inherit the mask of their creator, so OpenCV's worker pool created afterwards stays on these CPUs too */
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        printf("Warning: failed to pin to the requested CPUs\n");
+}
+
+/* nullptr for OpenCV's backend, which the parallel methods use unless a pool is set
+ */
+static shared_ptr<ins::ThreadPool> create_pool(const string& backend, const BenchmarkConfig& config)
+{
+    if (backend == "opencv")
+        return nullptr;
+    return make_shared<ins::ThreadPool>(config.threads > 0 ? config.threads : getNumThreads(), config.cpus,
+                                        backend == "dynamic" ? ins::ThreadPool::Schedule::DYNAMIC : ins::ThreadPool::Schedule::STATIC);
+}
+
+static void write_csv(const string& path, const vector<BenchmarkResult>& results)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file)
+    {
+        printf("Warning: failed to write %s\n", path.c_str());
+        return;
+    }
+
+    fprintf(file, "method,class,min_us,median_us,p99_us,mean_us,stddev_us,gb_per_s,reference,mismatches,cycles,instructions,llc_misses,dtlb_misses\n");
+    for (const BenchmarkResult& r : results)
+    {
+        fprintf(file, "%s,%s,%.1f,%.1f,%.1f,%.1f,%.1f,%.3f,%s,%lld",
+                r.name.c_str(), r.class_name.c_str(), r.min_us, r.median_us, r.p99_us, r.mean_us, r.stddev_us,
+                r.gigabytes_per_second, r.reference.c_str(), r.mismatches);
+        /* counter columns stay empty when they were not read */
+        for (int e = 0; e < ins::PerfSample::N_EVENTS; e++)
+        {
+            if (r.has_counters)
+                fprintf(file, ",%llu", static_cast<unsigned long long>(r.counters.counts[e]));
+            else
+                fprintf(file, ",");
+        }
+        fprintf(file, "\n");
+    }
+    fclose(file);
+}
+
+static void write_json(const string& path, const BenchmarkConfig& config, const vector<BenchmarkResult>& results)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file)
+    {
+        printf("Warning: failed to write %s\n", path.c_str());
+        return;
+    }
+
+    fprintf(file, "{\n  \"source\": [%d, %d],\n  \"resolution\": [%d, %d],\n  \"warmup\": %d,\n  \"iterations\": %d,\n  \"threads\": %d,\n  \"results\": [\n",
+            config.source.width, config.source.height, config.resolution.width, config.resolution.height,
+            config.warmup, config.iterations, getNumThreads());
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchmarkResult& r = results[i];
+        char counters[192] = "null";
+        if (r.has_counters)
+        {
+            const uint64_t* c = r.counters.counts;
+            snprintf(counters, sizeof(counters), "{\"cycles\": %llu, \"instructions\": %llu, \"llc_misses\": %llu, \"dtlb_misses\": %llu}",
+                     static_cast<unsigned long long>(c[ins::PerfSample::CYCLES]), static_cast<unsigned long long>(c[ins::PerfSample::INSTRUCTIONS]),
+                     static_cast<unsigned long long>(c[ins::PerfSample::LLC_MISSES]), static_cast<unsigned long long>(c[ins::PerfSample::DTLB_MISSES]));
+        }
+        fprintf(file, "    {\"method\": \"%s\", \"class\": \"%s\", \"min_us\": %.1f, \"median_us\": %.1f, \"p99_us\": %.1f, "
+                      "\"mean_us\": %.1f, \"stddev_us\": %.1f, \"gb_per_s\": %.3f, \"reference\": \"%s\", \"mismatches\": %lld, \"counters\": %s}%s\n",
+                r.name.c_str(), r.class_name.c_str(), r.min_us, r.median_us, r.p99_us, r.mean_us, r.stddev_us,
+                r.gigabytes_per_second, r.reference.c_str(), r.mismatches, counters, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+}
+
+
+int main(int argc, char** argv)
+{
+    BenchmarkConfig config;
+    if (!parse_args(argc, argv, config))
+        return EXIT_FAILURE;
+
+    if (!config.cpus.empty())
+        pin_process(config.cpus);
+    if (config.threads > 0)
+        setNumThreads(config.threads);
+
+    ins::Geometry geometry(config.source, config.resolution);
+    Mat transform_matrix = ins::get_transform_matrix(config.corners, config.source);
+    Mat frame = make_frame(config.source);
+
+    ins::Warp warp = transform_matrix;
+    try
+    {
+        if (!config.map_path.empty())
+            warp = ins::Warp::load(config.map_path);
+        else if (config.distortion != Vec2d())
+            warp = ins::Warp::radial(transform_matrix, config.resolution, config.distortion[0], config.distortion[1]);
+    }
+    catch (const cv::Exception& e)
+    {
+        printf("Failed to load the warp! : %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    if (!config.map_path.empty() && warp.map_size() != config.resolution)
+    {
+        printf("The map is %dx%d; set [resolution] to match\n", warp.map_size().width, warp.map_size().height);
+        return EXIT_FAILURE;
+    }
+    if (!warp.is_homography())
+        printf("Warp : %s\n", warp.summary().c_str());
+
+    vector<BenchmarkResult> results;
+    bool all_exact = true;
+
+    for (size_t b = 0; b < config.backends.size(); b++)
+    {
+        const string& backend = config.backends[b];
+        config.options.pool = create_pool(backend, config);
+        if (config.options.pool)
+            printf("%s\n", config.options.pool->summary().c_str());
+
+        for (const string& name : config.methods)
+        {
+            /* single-threaded methods do not depend on the backend, so they run once, with the first one listed */
+            const ins::LUTMethod* method = ins::find_lut_method(name);
+            bool threaded = method->has(ins::LUTMethod::MULTI_THREADED);
+            if (b > 0 && !threaded)
+                continue;
+
+            BenchmarkResult result = { config.options.pool && threaded ? name + "@" + backend : name, method->class_name, "-", 0, 0, 0, 0, 0, 0, -1, false, {} };
+            string counter_report;
+
+            try
+            {
+                Mat screen = Mat::zeros(config.resolution.height, config.resolution.width, CV_8UC4);
+                unique_ptr<ins::LUT> lut = method->create(warp, geometry, reinterpret_cast<uint*>(screen.data), config.options);
+                const uint* image_data = reinterpret_cast<const uint*>(frame.data);
+                measure(config, [&]{ lut->apply(image_data); }, result);
+
+                /* counters are read in a separate pass, so the system calls around each partition do not skew the timing */
+                if (config.counters)
+                {
+                    auto profiler = make_shared<ins::LUTProfiler>();
+                    lut->set_profiler(profiler);
+                    for (int i = 0; i < config.iterations; i++)
+                        profiler->measure_apply([&]{ lut->apply(image_data); });
+                    lut->set_profiler(nullptr);
+                    result.has_counters = profiler->available();
+                    result.counters = profiler->per_frame();
+                    counter_report = profiler->report();
+                }
+
+                /* the output is checked on a fresh screen, since scatter methods leave unmapped pixels untouched */
+                const char* reference = reference_method(lut.get(), config.options);
+                lut.reset();
+                if (reference)
+                {
+                    Mat expected = render(*ins::find_lut_method(reference), warp, geometry, config.options, frame);
+                    Mat actual = render(*method, warp, geometry, config.options, frame);
+                    const uint* e = reinterpret_cast<const uint*>(expected.data);
+                    const uint* a = reinterpret_cast<const uint*>(actual.data);
+                    result.reference = reference;
+                    result.mismatches = 0;
+                    /* threads of a parallel scatter race where several source pixels land on one screen pixel,
+                     * so there any of those source pixels is accepted; frame values are unique, so the match is exact
+                     */
+                    vector<char> contested_ok;
+                    if (method->has(ins::LUTMethod::RACY_SCATTER))
+                    {
+                        contested_ok.assign(expected.total(), 0);
+                        vector<int> offsets = ins::transform_offsets(warp, geometry);
+                        const uint* f = reinterpret_cast<const uint*>(frame.data);
+                        for (size_t i = 0; i < offsets.size(); i++)
+                        {
+                            if (offsets[i] >= 0 && a[offsets[i]] == f[i])
+                                contested_ok[offsets[i]] = 1;
+                        }
+                    }
+                    for (size_t i = 0; i < expected.total(); i++)
+                        result.mismatches += e[i] != a[i] && (contested_ok.empty() || !contested_ok[i]);
+                    all_exact = all_exact && result.mismatches == 0;
+                }
+                else
+                {
+                    result.mismatches = 0;
+                }
+            }
+            catch (const cv::Exception& e)
+            {
+                printf("Warning: %s could not be built: %s\n", name.c_str(), e.what());
+            }
+
+            string check = result.mismatches < 0 ? "skipped"
+                         : result.reference == "-" ? "unchecked (approximate)"
+                         : result.mismatches == 0 ? "matches " + result.reference
+                         : "MISMATCH against " + result.reference + ": " + to_string(result.mismatches) + " pixels";
+            print_result(result, check);
+            if (!counter_report.empty())
+                printf("%s\n", counter_report.c_str());
+            results.push_back(result);
+        }
+    }
+    config.options.pool = nullptr;
+
+    if (config.remap)
+        run_remap(config, warp, geometry, results);
+    if (!config.batches.empty())
+        all_exact = run_batches(config, warp, geometry) && all_exact;
+    if (config.dirty)
+        all_exact = run_dirty_patterns(config, warp, geometry) && all_exact;
+    if (!config.grids.empty())
+        run_mesh_grids(config, warp, geometry);
+
+    if (!config.csv_path.empty())
+        write_csv(config.csv_path, results);
+    if (!config.json_path.empty())
+        write_json(config.json_path, config, results);
+
+    return all_exact ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+bool parse_args(int argc, char** argv, BenchmarkConfig& config)
+{
+    const string keys =
+        "{h help     |         | print this message and exit. }"
+        "{@methods   |all      | comma-separated methods to run, or all. }"
+        "{corners    |242,172,1655,71,1714,955,255,921| desired TL, TR, BR, BL corners. format: x,y,x,y,x,y,x,y }"
+        "{source     |1920x1080| the size of the source frame. format: WxH }"
+        "{resolution |1920x1080| the size of screen. format: WxH }"
+        "{warmup     |10       | untimed runs before measuring. }"
+        "{iterations |100      | timed runs per method. }"
+        "{threads    |0        | worker threads of the parallel methods; 0 keeps the OpenCV default. }"
+        "{cpus       |         | pin the benchmark and its worker threads to these CPUs. format: 0,1,2,3 }"
+        "{backend    |opencv   | comma-separated parallel backends: opencv (cv::parallel_for_), static or dynamic (ins::ThreadPool). }"
+        "{span       |1        | incremental methods: pixels per projective division. }"
+        "{grid       |16       | mesh methods: screen pixels between the grid nodes that keep exact coordinates. }"
+        "{grids      |         | also time the mesh gather and report its error for each of these grid sizes. format: 4,8,16,32 }"
+        "{tile       |64x64    | tiled methods: the size of screen tiles; dirty-tiles: of source tiles. format: WxH }"
+        "{csv        |         | write the results to this CSV file. }"
+        "{json       |         | write the results to this JSON file. }"
+        "{dirty      |         | also time dirty-tile updates against full warps for typical partial-update patterns. }"
+        "{counters   |         | also read cycles, instructions, LLC and dTLB misses per frame and per thread in an extra pass (Linux perf_event_open). }"
+        "{map        |         | build every method from this warp map instead of the corners: a cv::FileStorage file with map_x and map_y, map_xy, or offsets and source_stride, of [resolution]. }"
+        "{distortion |         | bend the corners' homography with radial lens distortion about the screen centre. format: k1,k2 }"
+        "{remap      |         | also time cv::remap, nearest and bilinear, with float and fixed-point maps, on the same warp. }"
+        "{batches    |         | also time apply_batch, which warps several frames per pass over the table, for each of these batch sizes. format: 1,2,4,8 }";
+
+    CommandLineParser parser(argc, argv, keys);
+    parser.about(
+        "Benchmark the LUT methods and check each against its plain implementation bit for bit.\n"
+        "Exits with a failure status if any checked method differs from its reference.\n"
+        "\n"
+        "Following methods are currently available:\n"
+        + ins::lut_methods_help()
+    );
+
+    if (parser.has("help"))
+    {
+        parser.printMessage();
+        return false;
+    }
+
+    string tmps = parser.get<string>("@methods");
+    if (tmps == "all")
+    {
+        for (const ins::LUTMethod& method : ins::lut_methods())
+            config.methods.push_back(method.name);
+    }
+    else
+    {
+        stringstream names(tmps);
+        string name;
+        while (getline(names, name, ','))
+        {
+            if (!ins::find_lut_method(name))
+            {
+                printf("Unrecognizable method name! : %s\n", name.c_str());
+                return false;
+            }
+            config.methods.push_back(name);
+        }
+    }
+
+    tmps = parser.get<string>("corners");
+    regex corners_pattern(R"~((\d+),(\d+),(\d+),(\d+),(\d+),(\d+),(\d+),(\d+))~");
+    smatch matches;
+    if (regex_match(tmps, matches, corners_pattern))
+    {
+        for (int i = 0; i < 4; i++)
+            config.corners.push_back(Point2f(stoi(matches[2 * i + 1].str()), stoi(matches[2 * i + 2].str())));
+    }
+    else
+    {
+        printf("Error: failed to parse [corners]=%s\n", tmps.c_str());
+        return false;
+    }
+
+    regex resolution_pattern(R"~((\d+)[x|X](\d+))~");
+    Size* sizes[] = { &config.source, &config.resolution, &config.options.tile_size };
+    const char* size_keys[] = { "source", "resolution", "tile" };
+    for (int i = 0; i < 3; i++)
+    {
+        tmps = parser.get<string>(size_keys[i]);
+        if (regex_match(tmps, matches, resolution_pattern) && stoi(matches[1].str()) > 0 && stoi(matches[2].str()) > 0)
+            *sizes[i] = Size(stoi(matches[1].str()), stoi(matches[2].str()));
+        else
+        {
+            printf("Error: failed to parse [%s]=%s\n", size_keys[i], tmps.c_str());
+            return false;
+        }
+    }
+
+    tmps = parser.get<string>("cpus");
+    if (!tmps.empty())
+    {
+        stringstream cpus(tmps);
+        string cpu;
+        while (getline(cpus, cpu, ','))
+        {
+            if (!regex_match(cpu, regex(R"~(\d+)~")) || stoi(cpu) >= CPU_SETSIZE)
+            {
+                printf("Error: failed to parse [cpus]=%s\n", tmps.c_str());
+                return false;
+            }
+            config.cpus.push_back(stoi(cpu));
+        }
+    }
+
+    tmps = parser.get<string>("grids");
+    if (!tmps.empty())
+    {
+        stringstream grids(tmps);
+        string grid;
+        while (getline(grids, grid, ','))
+        {
+            if (!regex_match(grid, regex(R"~(\d+)~")) || stoi(grid) < 1)
+            {
+                printf("Error: failed to parse [grids]=%s\n", tmps.c_str());
+                return false;
+            }
+            config.grids.push_back(stoi(grid));
+        }
+    }
+
+    tmps = parser.get<string>("batches");
+    if (!tmps.empty())
+    {
+        stringstream batches(tmps);
+        string batch;
+        while (getline(batches, batch, ','))
+        {
+            if (!regex_match(batch, regex(R"~(\d+)~")) || stoi(batch) < 1)
+            {
+                printf("Error: failed to parse [batches]=%s\n", tmps.c_str());
+                return false;
+            }
+            config.batches.push_back(stoi(batch));
+        }
+    }
+
+    tmps = parser.get<string>("backend");
+    stringstream backends(tmps);
+    string backend;
+    while (getline(backends, backend, ','))
+    {
+        if (backend != "opencv" && backend != "static" && backend != "dynamic")
+        {
+            printf("Error: failed to parse [backend]=%s\n", tmps.c_str());
+            return false;
+        }
+        config.backends.push_back(backend);
+    }
+    if (config.backends.empty())
+        config.backends.push_back("opencv");
+
+    config.warmup = parser.get<int>("warmup");
+    config.iterations = parser.get<int>("iterations");
+    config.threads = parser.get<int>("threads");
+    config.options.span = parser.get<int>("span");
+    config.options.grid = parser.get<int>("grid");
+    config.csv_path = parser.get<string>("csv");
+    config.json_path = parser.get<string>("json");
+    config.dirty = parser.has("dirty");
+    config.counters = parser.has("counters");
+    config.map_path = parser.get<string>("map");
+    config.remap = parser.has("remap");
+
+    tmps = parser.get<string>("distortion");
+    config.distortion = Vec2d();
+    if (!tmps.empty())
+    {
+        if (!regex_match(tmps, matches, regex(R"~(([-+]?\d*\.?\d+),([-+]?\d*\.?\d+))~")))
+        {
+            printf("Error: failed to parse [distortion]=%s\n", tmps.c_str());
+            return false;
+        }
+        config.distortion = Vec2d(stod(matches[1].str()), stod(matches[2].str()));
+    }
+    if (!config.map_path.empty() && !tmps.empty())
+    {
+        printf("Error: [map] and [distortion] cannot be combined\n");
+        return false;
+    }
+
+    if (config.warmup < 0 || config.iterations < 1 || config.threads < 0 || config.options.span < 1 || config.options.grid < 1)
+    {
+        printf("Error: [warmup], [iterations], [threads], [span] and [grid] must not be negative; [iterations], [span] and [grid] must be positive\n");
+        return false;
+    }
+
+    if (!parser.check())
+    {
+        parser.printErrors();
+        return false;
+    }
+
+    return true;
+}
@@ -1,145 +1,1724 @@
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 #include "common.hpp"
+#include "lut_cache.hpp"
+#include "perf_counters.hpp"
+#include "thread_pool.hpp"
+
+
+namespace ins
+{
+
+
+Geometry::Geometry(int width, int height)
+    : Geometry(Size(width, height), Size(width, height))
+{
+}
+
+Geometry::Geometry(Size source, Size screen, int source_stride, int screen_stride)
+    : source(source), screen(screen),
+      source_stride(source_stride > 0 ? source_stride : source.width),
+      screen_stride(screen_stride > 0 ? screen_stride : screen.width)
+{
+    CV_Assert(source.width > 0 && source.height > 0 && screen.width > 0 && screen.height > 0);
+    CV_Assert(this->source_stride >= source.width && this->screen_stride >= screen.width);
+}
+
+
+Mat get_transform_matrix(vector<Point2f> desired_points, Size source_size)
+{
+    vector<Point2f> image_rect = {
+        Point2f(0, 0),
+        Point2f(source_size.width - 1, 0),
+        Point2f(source_size.width - 1, source_size.height - 1),
+        Point2f(0, source_size.height - 1)
+    };
+
+    return getPerspectiveTransform(image_rect, desired_points);
+}
+
+
+/* Maps every pixel of a grid through the homography without an intermediate coordinate vector;
+ * rows are evaluated in parallel and the arithmetic follows perspectiveTransform, so the results are identical.
+ * store(y * stride + x, point) is called once per pixel, from several threads.
+ */
+template<typename Store>
+static void transform_grid(Mat transform_matrix, Size grid, int stride, Store store)
+{
+    Matx33d m(transform_matrix);
+
+    parallel_for_(Range(0, grid.height), [&](const Range& rows){
+        for (int y = rows.start; y < rows.end; y++)
+        {
+            int index = y * stride;
+            for (int x = 0; x < grid.width; x++)
+            {
+                double w = x * m(2, 0) + y * m(2, 1) + m(2, 2);
+                w = fabs(w) > FLT_EPSILON ? 1. / w : 0;
+                store(index++, Point2f(static_cast<float>((x * m(0, 0) + y * m(0, 1) + m(0, 2)) * w),
+                                       static_cast<float>((x * m(1, 0) + y * m(1, 1) + m(1, 2)) * w)));
+            }
+        }
+    });
+}
+
+/* Screen position of every source pixel (source_to_screen) or source position of every screen pixel; homographies
+ * go through transform_grid, the other warps through their point maps. store(y * stride + x, point) as above.
+ */
+template<typename Store>
+static void warp_grid(const Warp& warp, bool source_to_screen, Size grid, int stride, Store store)
+{
+    if (warp.is_homography())
+    {
+        transform_grid(source_to_screen ? warp.homography() : Mat(warp.homography().inv()), grid, stride, store);
+        return;
+    }
+
+    Mat points = source_to_screen ? warp.screen_points(grid) : warp.source_points(grid);
+    parallel_for_(Range(0, grid.height), [&](const Range& rows){
+        for (int y = rows.start; y < rows.end; y++)
+        {
+            const Point2f* point = points.ptr<Point2f>(y);
+            for (int x = 0; x < grid.width; x++)
+                store(y * stride + x, point[x]);
+        }
+    });
+}
+
+/* Calls store(index) for the entries of a strided grid that lie past the end of each row
+ */
+template<typename Store>
+static void for_each_padding(Size grid, int stride, Store store)
+{
+    for (int y = 0; y < grid.height; y++)
+    {
+        for (int x = grid.width; x < stride; x++)
+        {
+            store(y * stride + x);
+        }
+    }
+}
+
+
+/* Calls kernel with the trip count as a compile-time constant for the common frame sizes (720p, 1080p, 4K),
+ * so those loops get constant bounds and can be unrolled; other sizes use the generic instantiation.
+ */
+template<typename Kernel>
+static inline void with_fixed_size(int count, Kernel kernel)
+{
+    switch (count)
+    {
+    case 1280 * 720: kernel(integral_constant<int, 1280 * 720>()); break;
+    case 1920 * 1080: kernel(integral_constant<int, 1920 * 1080>()); break;
+    case 3840 * 2160: kernel(integral_constant<int, 3840 * 2160>()); break;
+    default: kernel(count); break;
+    }
+}
+
+
+/* Calls kernel with the number of frames of a batch as a compile-time constant for batches of up to four, so the
+ * loop over the frames of one table entry unrolls and the frame pointers stay in registers; larger batches use
+ * the generic instantiation.
+ */
+template<typename Kernel>
+static inline void with_batch_size(int count, Kernel kernel)
+{
+    switch (count)
+    {
+    case 1: kernel(integral_constant<int, 1>()); break;
+    case 2: kernel(integral_constant<int, 2>()); break;
+    case 3: kernel(integral_constant<int, 3>()); break;
+    case 4: kernel(integral_constant<int, 4>()); break;
+    default: kernel(count); break;
+    }
+}
+
+
+/* Screen offset of every source pixel, in source raster order; -1 where the pixel lands off screen
+ */
+template<typename Store>
+static void for_each_offset(const Warp& warp, const Geometry& geometry, Store store)
+{
+    CV_Assert(geometry.source_stride == geometry.source.width);
+    const Size& screen = geometry.screen;
+
+    warp_grid(warp, true, geometry.source, geometry.source_stride, [&](int index, Point2f point){
+        Point2i pixel = Point2i(static_cast<int>(roundf(point.x)), static_cast<int>(roundf(point.y)));
+        if (pixel.x < 0 || pixel.x >= screen.width || pixel.y < 0 || pixel.y >= screen.height)
+            store(index, -1);
+        else
+            store(index, pixel.y * geometry.screen_stride + pixel.x);
+    });
+}
+
+vector<int> transform_offsets(const Warp& warp, const Geometry& geometry)
+{
+    vector<int> offsets(geometry.source.area());
+    for_each_offset(warp, geometry, [&](int index, int offset){
+        offsets[index] = offset;
+    });
+    return offsets;
+}
+
+static VisibleRuns clip_offsets(const vector<int>& offsets)
+{
+    VisibleRuns visible;
+    for (size_t i = 0; i < offsets.size(); i++)
+    {
+        if (offsets[i] >= 0)
+            visible.add(static_cast<int>(i));
+    }
+    visible.n_source = static_cast<int>(offsets.size());
+    return visible;
+}
+
+
+/* Source offset of every screen pixel, in screen raster order; -1 where the screen pixel has no source
+ */
+template<typename Store>
+static void for_each_inverse_offset(const Warp& warp, const Geometry& geometry, Store store)
+{
+    const Size& source = geometry.source;
+
+    warp_grid(warp, false, geometry.screen, geometry.screen_stride, [&](int index, Point2f point){
+        Point2i pixel = Point2i(static_cast<int>(roundf(point.x)), static_cast<int>(roundf(point.y)));
+        if (pixel.x < 0 || pixel.x >= source.width || pixel.y < 0 || pixel.y >= source.height)
+            store(index, -1);
+        else
+            store(index, pixel.y * geometry.source_stride + pixel.x);
+    });
+    for_each_padding(geometry.screen, geometry.screen_stride, [&](int index){
+        store(index, -1);
+    });
+}
+
+vector<int> inverse_offsets(const Warp& warp, const Geometry& geometry)
+{
+    vector<int> offsets(geometry.screen_buffer_size());
+    for_each_inverse_offset(warp, geometry, [&](int index, int offset){
+        offsets[index] = offset;
+    });
+    return offsets;
+}
+
+
+SimdISA detect_simd_isa()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx512f"))
+        return SimdISA::AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return SimdISA::AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return SimdISA::SSE41;
+#endif
+    return SimdISA::SCALAR;
+}
+
+const char* simd_isa_name(SimdISA isa)
+{
+    switch (isa)
+    {
+    case SimdISA::SSE41: return "SSE4.1";
+    case SimdISA::AVX2: return "AVX2";
+    case SimdISA::AVX512: return "AVX-512";
+    default: return "scalar";
+    }
+}
+
+
+const char* pixel_format_name(PixelFormat format)
+{
+    switch (format)
+    {
+    case PixelFormat::BGR24: return "BGR24";
+    case PixelFormat::RGB565: return "RGB565";
+    case PixelFormat::GRAY8: return "GRAY8";
+    case PixelFormat::NV12: return "NV12";
+    case PixelFormat::I420: return "I420";
+    default: return "BGRA32";
+    }
+}
+
+bool is_planar_yuv(PixelFormat format)
+{
+    return format == PixelFormat::NV12 || format == PixelFormat::I420;
+}
+
+
+static void gather_scalar(const uint32_t* lut, const uint* image_data, uint* screen, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t offset = lut[i];
+        screen[i] = offset == ReverseLUT::NO_SOURCE ? 0 : image_data[offset];
+    }
+}
+
+static void scatter_scalar(const uint32_t* lut, const uint* image_data, uint* screen, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        screen[lut[i]] = image_data[i];
+    }
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+/* SSE4.1 has no gather; sentinel lanes are redirected to offset 0 and masked out after four scalar loads */
+__attribute__((target("sse4.1")))
+static void gather_sse41(const uint32_t* lut, const uint* image_data, uint* screen, int count)
+{
+    const __m128i no_source = _mm_set1_epi32(-1);
+    int i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i offsets = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lut + i));
+        __m128i invalid = _mm_cmpeq_epi32(offsets, no_source);
+        offsets = _mm_andnot_si128(invalid, offsets);
+        __m128i pixels = _mm_set_epi32(image_data[_mm_extract_epi32(offsets, 3)], image_data[_mm_extract_epi32(offsets, 2)],
+                                       image_data[_mm_extract_epi32(offsets, 1)], image_data[_mm_extract_epi32(offsets, 0)]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(screen + i), _mm_andnot_si128(invalid, pixels));
+    }
+
+    gather_scalar(lut + i, image_data, screen + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void gather_avx2(const uint32_t* lut, const uint* image_data, uint* screen, int count)
+{
+    const __m256i no_source = _mm256_set1_epi32(-1);
+    int i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i offsets = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lut + i));
+        __m256i valid = _mm256_xor_si256(_mm256_cmpeq_epi32(offsets, no_source), no_source);
+        __m256i pixels = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), reinterpret_cast<const int*>(image_data), offsets, valid, 4);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(screen + i), pixels);
+    }
+
+    gather_scalar(lut + i, image_data, screen + i, count - i);
+}
+
+__attribute__((target("avx512f")))
+static void gather_avx512(const uint32_t* lut, const uint* image_data, uint* screen, int count)
+{
+    const __m512i no_source = _mm512_set1_epi32(-1);
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m512i offsets = _mm512_loadu_si512(lut + i);
+        __mmask16 valid = _mm512_cmpneq_epi32_mask(offsets, no_source);
+        __m512i pixels = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), valid, offsets, image_data, 4);
+        _mm512_storeu_si512(screen + i, pixels);
+    }
+
+    gather_scalar(lut + i, image_data, screen + i, count - i);
+}
+
+/* lanes with the same screen offset are written in lane order, so later source pixels still win */
+__attribute__((target("avx512f")))
+static void scatter_avx512(const uint32_t* lut, const uint* image_data, uint* screen, int count)
+{
+    int i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m512i offsets = _mm512_loadu_si512(lut + i);
+        __m512i pixels = _mm512_loadu_si512(image_data + i);
+        _mm512_i32scatter_epi32(screen, offsets, pixels, 4);
+    }
+
+    scatter_scalar(lut + i, image_data + i, screen, count - i);
+}
+#endif
+
+
+void run_parallel(ThreadPool* pool, LUTProfiler* profiler, const Range& range, const function<void(const Range&)>& body,
+                  int n_threads, int align)
+{
+    if (profiler)
+    {
+        function<void(const Range&)> measured = [&](const Range& partition){ profiler->measure_partition(partition, body); };
+        if (pool)
+            pool->run(range, measured, align);
+        else
+            parallel_for_(range, measured, n_threads);
+    }
+    else if (pool)
+        pool->run(range, body, align);
+    else
+        parallel_for_(range, body, n_threads);
+}
+
+
+LUT::LUT(int table_size)
+    : table_size(table_size)
+{
+}
+
+void LUT::run_parallel(const Range& range, const function<void(const Range&)>& body, int n_threads, int align) const
+{
+    ins::run_parallel(pool.get(), profiler.get(), range, body, n_threads, align);
+}
+
+
+void VisibleRuns::add(int src_offset)
+{
+    if (!runs.empty() && runs.back().src_offset + runs.back().length == src_offset)
+        runs.back().length++;
+    else
+        runs.push_back({ n_visible, src_offset, 1 });
+    n_visible++;
+}
+
+string VisibleRuns::summary() const
+{
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "%d of %d source pixels on screen in %zu runs, %.1f%% skipped",
+             n_visible, n_source, runs.size(), n_source > 0 ? 100. * (n_source - n_visible) / n_source : 0.);
+    return buffer;
+}
+
+
+PointerLUT::PointerLUT(const Warp& warp, const Geometry& geometry, uint* datastart)
+    : LUT(0)
+{
+    vector<int> offsets = transform_offsets(warp, geometry);
+    visible = clip_offsets(offsets);
+    table_size = visible.n_visible;
+    lookup_table = unique_ptr<uint*[]>(new uint*[table_size]);
+
+    parallel_for_(Range(0, table_size), [&](const Range& range){
+        visible.for_each(range, [&](int entry, int src_offset, int length){
+            for (int i = 0; i < length; i++)
+                lookup_table[entry + i] = datastart + offsets[src_offset + i];
+        });
+    });
+}
+
+string PointerLUT::summary() const
+{
+    return visible.summary();
+}
+
+
+RelocatableLUT::RelocatableLUT(int table_size, uint* datastart)
+    : LUT(table_size), datastart(datastart)
+{
+}
+
+void RelocatableLUT::apply(const uint* image_data)
+{
+    apply(image_data, datastart);
+}
+
+void RelocatableLUT::apply_batch(const uint* const* images, uint* const* screens, int count)
+{
+    for (int k = 0; k < count; k++)
+        apply(images[k], screens[k]);
+}
+
+
+OffsetLUT::OffsetLUT(const Warp& warp, const Geometry& geometry, uint* datastart)
+    : RelocatableLUT(0, datastart)
+{
+    vector<int> offsets = transform_offsets(warp, geometry);
+    visible = clip_offsets(offsets);
+    table_size = visible.n_visible;
+    uint32_t* table = new uint32_t[table_size];
+    lookup_table = shared_ptr<const uint32_t>(table, default_delete<uint32_t[]>());
+
+    parallel_for_(Range(0, table_size), [&](const Range& range){
+        visible.for_each(range, [&](int entry, int src_offset, int length){
+            for (int i = 0; i < length; i++)
+                table[entry + i] = static_cast<uint32_t>(offsets[src_offset + i]);
+        });
+    });
+}
+
+OffsetLUT::OffsetLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart)
+    : RelocatableLUT(0, datastart)
+{
+    CV_Assert(file->kind() == FILE_KIND && file->size() >= 2);
+    const uint32_t* data = file->data();
+    CV_Assert(data[1] <= static_cast<uint32_t>(file->size() - 2) / 2);
+    int n_runs = static_cast<int>(data[1]);
+
+    /* the file passed the header check, but apply trusts every run and offset, so they are checked against the
+     * frame sizes once here: runs ascend inside the source, offsets stay inside the screen
+     */
+    CV_Assert(geometry.source_stride == geometry.source.width && data[0] == static_cast<uint32_t>(geometry.source.area()));
+    visible.n_source = static_cast<int>(data[0]);
+    int64_t source_end = 0;
+    for (int r = 0; r < n_runs; r++)
+    {
+        int64_t src_offset = data[2 + 2 * r];
+        int64_t length = data[3 + 2 * r];
+        CV_Assert(src_offset >= source_end && length > 0 && src_offset + length <= visible.n_source);
+        visible.runs.push_back({ visible.n_visible, static_cast<int>(src_offset), static_cast<int>(length) });
+        visible.n_visible += static_cast<int>(length);
+        source_end = src_offset + length;
+    }
+    table_size = file->size() - 2 - 2 * n_runs;
+    CV_Assert(visible.n_visible == table_size);
+
+    const uint32_t* table = data + 2 + 2 * n_runs;
+    uint32_t screen_size = static_cast<uint32_t>(geometry.screen_buffer_size());
+    CV_Assert(all_of(table, table + table_size, [&](uint32_t offset){ return offset < screen_size; }));
+    lookup_table = shared_ptr<const uint32_t>(file, table);
+}
+
+void OffsetLUT::save(const string& path, uint64_t key) const
+{
+    vector<uint32_t> contents = { static_cast<uint32_t>(visible.n_source), static_cast<uint32_t>(visible.runs.size()) };
+    for (const VisibleRuns::Run& run : visible.runs)
+    {
+        contents.push_back(static_cast<uint32_t>(run.src_offset));
+        contents.push_back(static_cast<uint32_t>(run.length));
+    }
+    contents.insert(contents.end(), lookup_table.get(), lookup_table.get() + table_size);
+    MappedLUTFile::save(path, FILE_KIND, key, contents.data(), static_cast<int>(contents.size()));
+}
+
+void OffsetLUT::scatter_batch(const uint* const* images, uint* const* screens, int count, const Range& entries) const
+{
+    const uint32_t* lut = lookup_table.get();
+
+    with_batch_size(count, [&](auto n_frames){
+        visible.for_each(entries, [&](int entry, int src_offset, int length){
+            for (int i = 0; i < length; i++)
+            {
+                uint32_t offset = lut[entry + i];
+                for (int k = 0; k < n_frames; k++)
+                    screens[k][offset] = images[k][src_offset + i];
+            }
+        });
+    });
+}
+
+string OffsetLUT::summary() const
+{
+    return visible.summary();
+}
+
+
+ReverseLUT::ReverseLUT(const Warp& warp, const Geometry& geometry, uint* datastart)
+    : RelocatableLUT(geometry.screen_buffer_size(), datastart)
+{
+    uint32_t* table = new uint32_t[table_size];
+    lookup_table = shared_ptr<const uint32_t>(table, default_delete<uint32_t[]>());
+
+    for_each_inverse_offset(warp, geometry, [&](int index, int offset){
+        table[index] = offset < 0 ? NO_SOURCE : static_cast<uint32_t>(offset);
+    });
+}
+
+ReverseLUT::ReverseLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart)
+    : RelocatableLUT(file->size(), datastart)
+{
+    CV_Assert(file->kind() == FILE_KIND && table_size == geometry.screen_buffer_size());
+
+    /* one entry per screen pixel, each NO_SOURCE or inside the source, so apply can trust the table */
+    const uint32_t* table = file->data();
+    uint32_t source_size = static_cast<uint32_t>((geometry.source.height - 1) * geometry.source_stride + geometry.source.width);
+    CV_Assert(all_of(table, table + table_size, [&](uint32_t offset){ return offset == NO_SOURCE || offset < source_size; }));
+    lookup_table = shared_ptr<const uint32_t>(file, table);
+}
+
+void ReverseLUT::save(const string& path, uint64_t key) const
+{
+    MappedLUTFile::save(path, FILE_KIND, key, lookup_table.get(), table_size);
+}
+
+void ReverseLUT::gather_batch(const uint* const* images, uint* const* screens, int count, const Range& range) const
+{
+    const uint32_t* lut = lookup_table.get();
+
+    with_batch_size(count, [&](auto n_frames){
+        for (int i = range.start; i < range.end; i++)
+        {
+            uint32_t offset = lut[i];
+            if (offset == NO_SOURCE)
+            {
+                for (int k = 0; k < n_frames; k++)
+                    screens[k][i] = 0;
+            }
+            else
+            {
+                for (int k = 0; k < n_frames; k++)
+                    screens[k][i] = images[k][offset];
+            }
+        }
+    });
+}
+
+
+IncrementalLUT::IncrementalLUT(const Warp& warp, const Geometry& geometry, uint* datastart, int span)
+    : RelocatableLUT(geometry.screen_buffer_size(), datastart), geometry(geometry), span(span)
+{
+    CV_Assert(span >= 1);
+    if (!warp.is_homography())
+        CV_Error(Error::StsBadArg, "the incremental methods step through a homography and cannot follow a " + warp.summary());
+    inverse_matrix = Matx33d(Mat(warp.homography().inv()));
+}
+
+void IncrementalLUT::warp_rows(const uint* image_data, uint* screen, const Range& rows) const
+{
+    const Matx33d& m = inverse_matrix;
+    const int width = geometry.screen.width;
+    const Size& source = geometry.source;
+
+    for (int y = rows.start; y < rows.end; y++)
+    {
+        uint* screen_row = screen + y * geometry.screen_stride;
+
+        /* homogeneous source coordinates of (0, y); advancing x by one adds the first column of m */
+        double X = m(0, 1) * y + m(0, 2);
+        double Y = m(1, 1) * y + m(1, 2);
+        double W = m(2, 1) * y + m(2, 2);
+
+        double w = 1. / W;
+        double sx = X * w;
+        double sy = Y * w;
+
+        for (int x = 0; x < width; x += span)
+        {
+            int n = min(span, width - x);
+            X += m(0, 0) * n;
+            Y += m(1, 0) * n;
+            W += m(2, 0) * n;
+
+            w = 1. / W;
+            double next_sx = X * w;
+            double next_sy = Y * w;
+            double dx = (next_sx - sx) / n;
+            double dy = (next_sy - sy) / n;
+
+            for (int i = 0; i < n; i++)
+            {
+                int px = static_cast<int>(roundf(static_cast<float>(sx)));
+                int py = static_cast<int>(roundf(static_cast<float>(sy)));
+                *screen_row++ = (px < 0 || px >= source.width || py < 0 || py >= source.height) ? 0 : image_data[py * geometry.source_stride + px];
+                sx += dx;
+                sy += dy;
+            }
+
+            sx = next_sx;
+            sy = next_sy;
+        }
+    }
+}
+
+
+MeshLUT::MeshLUT(const Warp& warp, const Geometry& geometry, uint* datastart, int grid)
+    : RelocatableLUT(geometry.screen_buffer_size(), datastart), warp(warp), geometry(geometry), grid(grid)
+{
+    CV_Assert(grid >= 1 && geometry.source.width < 16384 && geometry.source.height < 16384);
+
+    const Size& screen = geometry.screen;
+    nodes_x = (screen.width + grid - 2) / grid + 1;
+    nodes_y = (screen.height + grid - 2) / grid + 1;
+    nodes.resize(nodes_x * nodes_y);
+
+    /* same arithmetic as the exact tables; coordinates far off the source are clamped to fit the fixed-point range */
+    auto fixed = [](double coordinate) {
+        return static_cast<int32_t>(lround(min(max(coordinate, -16384.), 16384.) * 65536));
+    };
+    Mat points = warp.is_homography() ? Mat() : warp.source_points(screen);
+    Matx33d m(warp.is_homography() ? Mat(warp.homography().inv()) : Mat::eye(3, 3, CV_64FC1));
+    for (int j = 0; j < nodes_y; j++)
+    {
+        int y = min(j * grid, screen.height - 1);
+        for (int i = 0; i < nodes_x; i++)
+        {
+            int x = min(i * grid, screen.width - 1);
+            if (!points.empty())
+            {
+                Point2f point = points.at<Point2f>(y, x);
+                nodes[j * nodes_x + i] = { fixed(point.x), fixed(point.y) };
+                continue;
+            }
+            double w = x * m(2, 0) + y * m(2, 1) + m(2, 2);
+            w = fabs(w) > FLT_EPSILON ? 1. / w : 0;
+            nodes[j * nodes_x + i] = { fixed(static_cast<float>((x * m(0, 0) + y * m(0, 1) + m(0, 2)) * w)),
+                                       fixed(static_cast<float>((x * m(1, 0) + y * m(1, 1) + m(1, 2)) * w)) };
+        }
+    }
+}
+
+template<typename Visit>
+void MeshLUT::for_each_coordinate(const Range& rows, Visit visit) const
+{
+    const int width = geometry.screen.width;
+    const int height = geometry.screen.height;
+
+    for (int y = rows.start; y < rows.end; y++)
+    {
+        /* the node rows above and below y, and the 16-bit weight of the lower one */
+        int j = nodes_y > 1 ? min(y / grid, nodes_y - 2) : 0;
+        int y0 = j * grid;
+        int y1 = min(y0 + grid, height - 1);
+        int64_t t = y1 > y0 ? (static_cast<int64_t>(y - y0) << 16) / (y1 - y0) : 0;
+        const Node* top = &nodes[j * nodes_x];
+        const Node* bottom = nodes_y > 1 ? top + nodes_x : top;
+        auto edge = [&](int i) {
+            return Node{ static_cast<int32_t>(top[i].x + ((bottom[i].x - static_cast<int64_t>(top[i].x)) * t >> 16)),
+                         static_cast<int32_t>(top[i].y + ((bottom[i].y - static_cast<int64_t>(top[i].y)) * t >> 16)) };
+        };
+
+        /* between two node columns the coordinates advance by a constant step */
+        Node left = edge(0);
+        int x = 0;
+        for (int i = 1; i < nodes_x; i++)
+        {
+            Node right = edge(i);
+            int x_end = min(i * grid, width - 1);
+            int n = x_end - x;
+            int32_t dx = static_cast<int32_t>((right.x - static_cast<int64_t>(left.x)) / n);
+            int32_t dy = static_cast<int32_t>((right.y - static_cast<int64_t>(left.y)) / n);
+            int32_t sx = left.x;
+            int32_t sy = left.y;
+            for (; x < x_end; x++)
+            {
+                visit(x, y, sx, sy);
+                sx += dx;
+                sy += dy;
+            }
+            left = right;
+        }
+        visit(width - 1, y, left.x, left.y);
+    }
+}
+
+void MeshLUT::warp_rows(const uint* image_data, uint* screen, const Range& rows) const
+{
+    const unsigned source_width = geometry.source.width;
+    const unsigned source_height = geometry.source.height;
+    const int source_stride = geometry.source_stride;
+    const int screen_stride = geometry.screen_stride;
+
+    for_each_coordinate(rows, [&](int x, int y, int32_t sx, int32_t sy){
+        int px = (sx + 0x8000) >> 16;
+        int py = (sy + 0x8000) >> 16;
+        screen[y * screen_stride + x] = (static_cast<unsigned>(px) < source_width && static_cast<unsigned>(py) < source_height) ? image_data[py * source_stride + px] : 0;
+    });
+}
+
+void MeshLUT::warp_rows_batch(const uint* const* images, uint* const* screens, int count, const Range& rows) const
+{
+    const unsigned source_width = geometry.source.width;
+    const unsigned source_height = geometry.source.height;
+    const int source_stride = geometry.source_stride;
+    const int screen_stride = geometry.screen_stride;
+
+    /* the coordinates are interpolated once per screen pixel for all frames */
+    with_batch_size(count, [&](auto n_frames){
+        for_each_coordinate(rows, [&](int x, int y, int32_t sx, int32_t sy){
+            int px = (sx + 0x8000) >> 16;
+            int py = (sy + 0x8000) >> 16;
+            int index = y * screen_stride + x;
+            if (static_cast<unsigned>(px) < source_width && static_cast<unsigned>(py) < source_height)
+            {
+                int offset = py * source_stride + px;
+                for (int k = 0; k < n_frames; k++)
+                    screens[k][index] = images[k][offset];
+            }
+            else
+            {
+                for (int k = 0; k < n_frames; k++)
+                    screens[k][index] = 0;
+            }
+        });
+    });
+}
+
+MeshLUT::Error MeshLUT::error() const
+{
+    if (has_error)
+        return measured_error;
+
+    const Size& source = geometry.source;
+    const int height = geometry.screen.height;
+    Mat points = warp.is_homography() ? Mat() : warp.source_points(geometry.screen);
+    Matx33d m(warp.is_homography() ? Mat(warp.homography().inv()) : Mat::eye(3, 3, CV_64FC1));
+    vector<double> row_sum(height, 0), row_max(height, 0);
+    vector<int> row_covered(height, 0), row_mismatched(height, 0);
+
+    parallel_for_(Range(0, height), [&](const Range& rows){
+        for_each_coordinate(rows, [&](int x, int y, int32_t sx, int32_t sy){
+            float exact_x, exact_y;
+            if (points.empty())
+            {
+                double w = x * m(2, 0) + y * m(2, 1) + m(2, 2);
+                w = fabs(w) > FLT_EPSILON ? 1. / w : 0;
+                exact_x = static_cast<float>((x * m(0, 0) + y * m(0, 1) + m(0, 2)) * w);
+                exact_y = static_cast<float>((x * m(1, 0) + y * m(1, 1) + m(1, 2)) * w);
+            }
+            else
+            {
+                Point2f point = points.at<Point2f>(y, x);
+                exact_x = point.x;
+                exact_y = point.y;
+            }
+            int exact_px = static_cast<int>(roundf(exact_x));
+            int exact_py = static_cast<int>(roundf(exact_y));
+            bool exact_inside = exact_px >= 0 && exact_px < source.width && exact_py >= 0 && exact_py < source.height;
+
+            int px = (sx + 0x8000) >> 16;
+            int py = (sy + 0x8000) >> 16;
+            bool inside = px >= 0 && px < source.width && py >= 0 && py < source.height;
+
+            if (exact_inside)
+            {
+                double distance = hypot(sx / 65536. - exact_x, sy / 65536. - exact_y);
+                row_sum[y] += distance;
+                row_max[y] = max(row_max[y], distance);
+                row_covered[y]++;
+            }
+            if (inside != exact_inside || (inside && (px != exact_px || py != exact_py)))
+                row_mismatched[y]++;
+        });
+    });
+
+    Error error = { 0, 0, 0 };
+    double covered = 0;
+    for (int y = 0; y < height; y++)
+    {
+        error.mean_px += row_sum[y];
+        error.max_px = max(error.max_px, row_max[y]);
+        error.mismatched += row_mismatched[y];
+        covered += row_covered[y];
+    }
+    error.mean_px = covered > 0 ? error.mean_px / covered : 0;
+    error.mismatched /= geometry.screen.area();
+    measured_error = error;
+    has_error = true;
+    return error;
+}
+
+string MeshLUT::summary() const
+{
+    double full_bytes = static_cast<double>(geometry.screen_buffer_size()) * sizeof(uint32_t);
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "grid %d : %dx%d nodes, %.1f KB against %.1f MB for ReverseLUT (%.0fx smaller)",
+             grid, nodes_x, nodes_y, table_bytes() / 1024., full_bytes / (1024 * 1024), full_bytes / table_bytes());
+    string text = buffer;
+    if (has_error)
+    {
+        snprintf(buffer, sizeof(buffer), "; error mean %.3f px, max %.3f px, %.2f%% of pixels sample another source pixel",
+                 measured_error.mean_px, measured_error.max_px, 100. * measured_error.mismatched);
+        text += buffer;
+    }
+    return text;
+}
+
+
+SpanLUT::SpanLUT(const Warp& warp, const Geometry& geometry, uint* datastart)
+    : RelocatableLUT(geometry.source.area(), datastart)
+{
+    vector<int> offsets = transform_offsets(warp, geometry);
+    int screen_size = geometry.screen_buffer_size();
+
+    /* only the last source pixel written to a screen pixel is visible */
+    vector<int> last_writer(screen_size, -1);
+    n_visible = 0;
+    for (int i = 0; i < table_size; i++)
+    {
+        if (offsets[i] >= 0 && offsets[i] < screen_size)
+        {
+            last_writer[offsets[i]] = i;
+            n_visible++;
+        }
+    }
+
+    for (int i = 0; i < table_size; i++)
+    {
+        int offset = offsets[i];
+        if (offset < 0 || offset >= screen_size || last_writer[offset] != i)
+            continue;
+
+        if (!spans.empty())
+        {
+            Span& last = spans.back();
+            if (last.src_offset + last.length == static_cast<uint32_t>(i) && last.dst_offset + last.length == static_cast<uint32_t>(offset))
+            {
+                last.length++;
+                continue;
+            }
+        }
+        spans.push_back({ static_cast<uint32_t>(offset), static_cast<uint32_t>(i), 1 });
+    }
+    spans.shrink_to_fit();
+}
+
+void SpanLUT::copy_span(const uint* image_data, uint* screen, const Span& span)
+{
+    const uint* src = image_data + span.src_offset;
+    uint* dst = screen + span.dst_offset;
+
+    /* memcpy call overhead dominates for the short runs of a downscaling transform */
+    if (span.length >= 16)
+    {
+        memcpy(dst, src, span.length * sizeof(uint));
+    }
+    else
+    {
+        for (uint32_t i = 0; i < span.length; i++)
+            dst[i] = src[i];
+    }
+}
+
+double SpanLUT::compression_ratio() const
+{
+    return size() > 0 ? static_cast<double>(n_visible) / size() : 0;
+}
+
+string SpanLUT::summary() const
+{
+    char buffer[256];
+    size_t copied = 0;
+    for (const Span& span : spans)
+        copied += span.length;
+    snprintf(buffer, sizeof(buffer), "%zu spans (%.1f KiB), %.2f pixels per span, compression ratio %.2f against OffsetLUT, %.1f%% of source pixels skipped (off screen or overwritten)",
+             spans.size(), size() * sizeof(uint32_t) / 1024., static_cast<double>(copied) / spans.size(), compression_ratio(),
+             100. * (table_size - copied) / table_size);
+    return buffer;
+}
+
+
+TiledLUT::TiledLUT(const Warp& warp, const Geometry& geometry, uint* datastart, Size tile_size)
+    : RelocatableLUT(geometry.source.area(), datastart)
+{
+    CV_Assert(tile_size.width > 0 && tile_size.height > 0);
+
+    vector<int> offsets = transform_offsets(warp, geometry);
+    int stride = geometry.screen_stride;
+    int screen_size = geometry.screen_buffer_size();
+
+    int tiles_x = (stride + tile_size.width - 1) / tile_size.width;
+    int tiles_y = (geometry.screen.height + tile_size.height - 1) / tile_size.height;
+    int n_tiles = tiles_x * tiles_y;
+
+    auto tile_of = [&](int offset) {
+        return (offset / stride / tile_size.height) * tiles_x + (offset % stride) / tile_size.width;
+    };
+
+    /* counting sort by screen tile; stable, so later source pixels still overwrite earlier ones */
+    tile_begin.assign(n_tiles + 1, 0);
+    for (int i = 0; i < table_size; i++)
+    {
+        if (offsets[i] >= 0 && offsets[i] < screen_size)
+            tile_begin[tile_of(offsets[i]) + 1]++;
+    }
+    for (int t = 0; t < n_tiles; t++)
+    {
+        tile_begin[t + 1] += tile_begin[t];
+    }
+
+    n_entries = tile_begin[n_tiles];
+    lookup_table = unique_ptr<Entry[]>(new Entry[n_entries]);
+
+    vector<int> cursor(tile_begin.begin(), tile_begin.end() - 1);
+    for (int i = 0; i < table_size; i++)
+    {
+        if (offsets[i] >= 0 && offsets[i] < screen_size)
+            lookup_table[cursor[tile_of(offsets[i])]++] = { static_cast<uint32_t>(i), static_cast<uint32_t>(offsets[i]) };
+    }
+}
+
+void TiledLUT::apply_tiles(const uint* image_data, uint* screen, const Range& tiles) const
+{
+    const Entry* lut = lookup_table.get() + tile_begin[tiles.start];
+    const Entry* lut_end = lookup_table.get() + tile_begin[tiles.end];
+
+    while (lut < lut_end)
+    {
+        screen[lut->dst_offset] = image_data[lut->src_offset];
+        lut++;
+    }
+}
+
+string TiledLUT::summary() const
+{
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "%zu screen tiles, %d entries, %.1f%% of source pixels skipped",
+             tile_begin.size() - 1, n_entries, 100. * (table_size - n_entries) / table_size);
+    return buffer;
+}
+
+
+BilinearLUT::BilinearLUT(const Warp& warp, const Geometry& geometry, uint* datastart)
+    : RelocatableLUT(geometry.screen_buffer_size(), datastart), source_stride(geometry.source_stride)
+{
+    const Size& source = geometry.source;
+    CV_Assert(source.width >= 2 && source.height >= 2 && source_stride * source.height < (1 << 24));
+
+    lookup_table = unique_ptr<uint32_t[]>(new uint32_t[table_size]);
+
+    /* splits a coordinate into the base pixel and a 4-bit weight of the next pixel */
+    auto quantize = [](float coordinate, int size, int& base, int& weight) {
+        coordinate = min(max(coordinate, 0.f), static_cast<float>(size - 1));
+        base = min(static_cast<int>(coordinate), size - 2);
+        weight = static_cast<int>(roundf((coordinate - base) * 16));
+        if (weight == 16)
+        {
+            if (base < size - 2)
+            {
+                base++;
+                weight = 0;
+            }
+            else
+                weight = 15;
+        }
+    };
+
+    warp_grid(warp, false, geometry.screen, geometry.screen_stride, [&](int index, Point2f point){
+        int px = static_cast<int>(roundf(point.x));
+        int py = static_cast<int>(roundf(point.y));
+        if (px < 0 || px >= source.width || py < 0 || py >= source.height)
+        {
+            lookup_table[index] = NO_SOURCE;
+            return;
+        }
+
+        int x0, y0, fx, fy;
+        quantize(point.x, source.width, x0, fx);
+        quantize(point.y, source.height, y0, fy);
+        lookup_table[index] = static_cast<uint32_t>(y0 * source_stride + x0) << 8 | fx << 4 | fy;
+    });
+    for_each_padding(geometry.screen, geometry.screen_stride, [&](int index){
+        lookup_table[index] = NO_SOURCE;
+    });
+}
+
+/* blends the 2x2 neighbourhood; B,R and G,A are weighted two channels at a time in 16-bit lanes */
+inline uint BilinearLUT::blend(const uint* image_data, int source_stride, uint32_t entry)
+{
+    const uint* p = image_data + (entry >> 8);
+    uint fx = (entry >> 4) & 0xF;
+    uint fy = entry & 0xF;
+
+    uint w00 = (16 - fx) * (16 - fy);
+    uint w01 = fx * (16 - fy);
+    uint w10 = (16 - fx) * fy;
+    uint w11 = fx * fy;
+
+    uint p00 = p[0], p01 = p[1], p10 = p[source_stride], p11 = p[source_stride + 1];
+
+    uint br = (p00 & 0x00FF00FF) * w00 + (p01 & 0x00FF00FF) * w01 + (p10 & 0x00FF00FF) * w10 + (p11 & 0x00FF00FF) * w11 + 0x00800080;
+    uint ga = ((p00 >> 8) & 0x00FF00FF) * w00 + ((p01 >> 8) & 0x00FF00FF) * w01 + ((p10 >> 8) & 0x00FF00FF) * w10 + ((p11 >> 8) & 0x00FF00FF) * w11 + 0x00800080;
+
+    return ((br >> 8) & 0x00FF00FF) | (ga & 0xFF00FF00);
+}
+
+
+void BilinearLUT::blend_batch(const uint* const* images, uint* const* screens, int count, const Range& range) const
+{
+    const uint32_t* lut = lookup_table.get();
+
+    with_batch_size(count, [&](auto n_frames){
+        for (int i = range.start; i < range.end; i++)
+        {
+            uint32_t entry = lut[i];
+            for (int k = 0; k < n_frames; k++)
+                screens[k][i] = entry == NO_SOURCE ? 0 : blend(images[k], source_stride, entry);
+        }
+    });
+}
+
+
+/* 3-byte packed pixel, copied as a whole */
+struct Pixel24
+{
+    uint8_t bytes[3];
+};
+
+template<typename Pixel>
+static void gather_pixels(const uint32_t* lut, const Pixel* image, Pixel* screen, int count, Pixel fill)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t offset = lut[i];
+        screen[i] = offset == FormatLUT::NO_SOURCE ? fill : image[offset];
+    }
+}
+
+FormatLUT::FormatLUT(const Warp& warp, const Geometry& geometry, uint* datastart, PixelFormat format)
+    : RelocatableLUT(geometry.screen_buffer_size(), datastart), format(format), geometry(geometry)
+{
+    lookup_table = unique_ptr<uint32_t[]>(new uint32_t[table_size]);
+    for_each_inverse_offset(warp, geometry, [&](int index, int offset){
+        lookup_table[index] = offset < 0 ? NO_SOURCE : static_cast<uint32_t>(offset);
+    });
+    row_groups = geometry.screen.height;
+
+    if (!is_planar_yuv(format))
+        return;
+
+    /* chroma sample (u, v) sits at luma (2u, 2v): the chroma warp is the luma warp scaled by 1/2 */
+    CV_Assert(geometry.source.width % 2 == 0 && geometry.source.height % 2 == 0 && geometry.source_stride % 2 == 0);
+    CV_Assert(geometry.screen.width % 2 == 0 && geometry.screen.height % 2 == 0 && geometry.screen_stride % 2 == 0);
+    Geometry chroma(Size(geometry.source.width / 2, geometry.source.height / 2), Size(geometry.screen.width / 2, geometry.screen.height / 2),
+                    geometry.source_stride / 2, geometry.screen_stride / 2);
+    Warp chroma_warp = warp.scaled(0.5);
+
+    chroma_table = unique_ptr<uint32_t[]>(new uint32_t[chroma.screen_buffer_size()]);
+    for_each_inverse_offset(chroma_warp, chroma, [&](int index, int offset){
+        chroma_table[index] = offset < 0 ? NO_SOURCE : static_cast<uint32_t>(offset);
+    });
+    row_groups = geometry.screen.height / 2;
+}
+
+void FormatLUT::apply_rows(const uint* image_data, uint* screen, const Range& rows) const
+{
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(image_data);
+    uint8_t* dst = reinterpret_cast<uint8_t*>(screen);
+    int stride = geometry.screen_stride;
+    int begin = rows.start * stride;
+    int count = rows.size() * stride;
+
+    switch (format)
+    {
+    case PixelFormat::BGRA32:
+        gather_pixels(lookup_table.get() + begin, reinterpret_cast<const uint32_t*>(src), reinterpret_cast<uint32_t*>(dst) + begin, count, 0u);
+        break;
+    case PixelFormat::BGR24:
+        gather_pixels(lookup_table.get() + begin, reinterpret_cast<const Pixel24*>(src), reinterpret_cast<Pixel24*>(dst) + begin, count, Pixel24());
+        break;
+    case PixelFormat::RGB565:
+        gather_pixels(lookup_table.get() + begin, reinterpret_cast<const uint16_t*>(src), reinterpret_cast<uint16_t*>(dst) + begin, count, uint16_t(0));
+        break;
+    case PixelFormat::GRAY8:
+        gather_pixels(lookup_table.get() + begin, src, dst + begin, count, uint8_t(0));
+        break;
+    case PixelFormat::NV12:
+    case PixelFormat::I420:
+    {
+        /* one row group is two luma rows and one row of each chroma plane; uncovered chroma is neutral grey */
+        gather_pixels(lookup_table.get() + 2 * begin, src, dst + 2 * begin, 2 * count, uint8_t(0));
+
+        int source_plane = geometry.source_stride * geometry.source.height;
+        int screen_plane = stride * geometry.screen.height;
+        const uint32_t* chroma_lut = chroma_table.get() + begin / 2;
+
+        if (format == PixelFormat::NV12)
+        {
+            gather_pixels(chroma_lut, reinterpret_cast<const uint16_t*>(src + source_plane),
+                          reinterpret_cast<uint16_t*>(dst + screen_plane) + begin / 2, count / 2, uint16_t(0x8080));
+        }
+        else
+        {
+            for (int plane = 0; plane < 2; plane++)
+            {
+                gather_pixels(chroma_lut, src + source_plane + plane * source_plane / 4,
+                              dst + screen_plane + plane * screen_plane / 4 + begin / 2, count / 2, uint8_t(0x80));
+            }
+        }
+        break;
+    }
+    }
+}
+
+string FormatLUT::summary() const
+{
+    char buffer[128];
+    if (chroma_table)
+        snprintf(buffer, sizeof(buffer), "format %s, %d luma and %d chroma entries", pixel_format_name(format), table_size, table_size / 4);
+    else
+        snprintf(buffer, sizeof(buffer), "format %s, %d entries", pixel_format_name(format), table_size);
+    return buffer;
+}
+
+
+PlainLUT::PlainLUT(const Warp& warp, const Geometry& geometry, uint* datastart)
+    : PointerLUT(warp, geometry, datastart)
+{
+}
+
+void PlainLUT::apply(const uint* image_data)
+{
+    uint** lut = lookup_table.get();
+
+    for (const VisibleRuns::Run& run : visible.runs)
+    {
+        const uint* image_run = image_data + run.src_offset;
+        with_fixed_size(run.length, [&](auto count){
+            for (int i = 0; i < count; i++)
+            {
+                **lut++ = *image_run++;
+            }
+        });
+    }
+}
+
+
+ParallelLUT::ParallelLUT(const Warp& warp, const Geometry& geometry, uint* datastart)
+    : PointerLUT(warp, geometry, datastart)
+{
+    n_threads = getNumThreads();
+}
+
+void ParallelLUT::apply(const uint* image_data)
+{
+    uint** lut = lookup_table.get();
+
+    run_parallel(Range(0, table_size), [&](const Range& range){
+        visible.for_each(range, [&](int entry, int src_offset, int length){
+            uint** lut_partial = lut + entry;
+            const uint* image_partial = image_data + src_offset;
+            for (int r = 0; r < length; r++)
+            {
+                **lut_partial++ = *image_partial++;
+            }
+        });
+    }, n_threads, CACHE_LINE_PIXELS);
+}
+
+
+PlainOffsetLUT::PlainOffsetLUT(const Warp& warp, const Geometry& geometry, uint* datastart)
+    : OffsetLUT(warp, geometry, datastart)
+{
+}
+
+PlainOffsetLUT::PlainOffsetLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart)
+    : OffsetLUT(file, geometry, datastart)
+{
+}
+
+void PlainOffsetLUT::apply(const uint* image_data, uint* screen)
+{
+    const uint32_t* lut = lookup_table.get();
+
+    for (const VisibleRuns::Run& run : visible.runs)
+    {
+        const uint* image_run = image_data + run.src_offset;
+        with_fixed_size(run.length, [&](auto count){
+            for (int i = 0; i < count; i++)
+            {
+                screen[*lut++] = *image_run++;
+            }
+        });
+    }
+}
+
+void PlainOffsetLUT::apply_batch(const uint* const* images, uint* const* screens, int count)
+{
+    scatter_batch(images, screens, count, Range(0, table_size));
+}
 
 
-namespace ins
+ParallelOffsetLUT::ParallelOffsetLUT(const Warp& warp, const Geometry& geometry, uint* datastart)
+    : OffsetLUT(warp, geometry, datastart)
 {
+    n_threads = getNumThreads();
+}
 
+ParallelOffsetLUT::ParallelOffsetLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart)
+    : OffsetLUT(file, geometry, datastart)
+{
+    n_threads = getNumThreads();
+}
 
-Mat get_transform_matrix(vector<Point2f> desired_points)
+void ParallelOffsetLUT::apply(const uint* image_data, uint* screen)
 {
-    vector<Point2f> image_rect = {
-        Point2f(0, 0),
-        Point2f(DISPLAY_W - 1, 0),
-        Point2f(DISPLAY_W - 1, DISPLAY_H - 1),
-        Point2f(0, DISPLAY_H - 1)
-    };
+    const uint32_t* lut = lookup_table.get();
 
-    return getPerspectiveTransform(image_rect, desired_points);
+    run_parallel(Range(0, table_size), [&](const Range& range){
+        visible.for_each(range, [&](int entry, int src_offset, int length){
+            const uint32_t* lut_partial = lut + entry;
+            const uint* image_partial = image_data + src_offset;
+            for (int r = 0; r < length; r++)
+            {
+                screen[*lut_partial++] = *image_partial++;
+            }
+        });
+    }, n_threads, CACHE_LINE_PIXELS);
 }
 
+void ParallelOffsetLUT::apply_batch(const uint* const* images, uint* const* screens, int count)
+{
+    run_parallel(Range(0, table_size), [&](const Range& range){
+        scatter_batch(images, screens, count, range);
+    }, n_threads, CACHE_LINE_PIXELS);
+}
+
+
+PlainReverseLUT::PlainReverseLUT(const Warp& warp, const Geometry& geometry, uint* datastart)
+    : ReverseLUT(warp, geometry, datastart)
+{
+}
 
-LUT::LUT(Mat transform_matrix, int width, int height, uint* datastart)
+PlainReverseLUT::PlainReverseLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart)
+    : ReverseLUT(file, geometry, datastart)
 {
-    table_size = width * height;
-    lookup_table = make_unique<uint*[]>(table_size);
+}
 
-    vector<Point2f> coordinates_map;
-    for (int y = 0; y < height; y++)
+void PlainReverseLUT::apply(const uint* image_data, uint* screen)
+{
+    const uint32_t* lut = lookup_table.get();
+
+    with_fixed_size(table_size, [&](auto count){
+        for (int i = 0; i < count; i++)
+        {
+            uint32_t offset = *lut++;
+            *screen++ = offset == NO_SOURCE ? 0 : image_data[offset];
+        }
+    });
+}
+
+void PlainReverseLUT::apply_batch(const uint* const* images, uint* const* screens, int count)
+{
+    gather_batch(images, screens, count, Range(0, table_size));
+}
+
+
+ParallelReverseLUT::ParallelReverseLUT(const Warp& warp, const Geometry& geometry, uint* datastart)
+    : ReverseLUT(warp, geometry, datastart)
+{
+    n_threads = getNumThreads();
+}
+
+ParallelReverseLUT::ParallelReverseLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart)
+    : ReverseLUT(file, geometry, datastart)
+{
+    n_threads = getNumThreads();
+}
+
+void ParallelReverseLUT::apply(const uint* image_data, uint* screen)
+{
+    const uint32_t* lut = lookup_table.get();
+
+    run_parallel(Range(0, table_size), [&](const Range& range){
+        const uint32_t* lut_partial = lut + range.start;
+        uint* screen_partial = screen + range.start;
+        for (int r = range.start; r < range.end; r++)
+        {
+            uint32_t offset = *lut_partial++;
+            *screen_partial++ = offset == NO_SOURCE ? 0 : image_data[offset];
+        }
+    }, n_threads, CACHE_LINE_PIXELS);
+}
+
+void ParallelReverseLUT::apply_batch(const uint* const* images, uint* const* screens, int count)
+{
+    run_parallel(Range(0, table_size), [&](const Range& range){
+        gather_batch(images, screens, count, range);
+    }, n_threads, CACHE_LINE_PIXELS);
+}
+
+
+PlainIncrementalLUT::PlainIncrementalLUT(const Warp& warp, const Geometry& geometry, uint* datastart, int span)
+    : IncrementalLUT(warp, geometry, datastart, span)
+{
+}
+
+void PlainIncrementalLUT::apply(const uint* image_data, uint* screen)
+{
+    warp_rows(image_data, screen, Range(0, geometry.screen.height));
+}
+
+
+ParallelIncrementalLUT::ParallelIncrementalLUT(const Warp& warp, const Geometry& geometry, uint* datastart, int span)
+    : IncrementalLUT(warp, geometry, datastart, span)
+{
+    n_threads = getNumThreads();
+}
+
+void ParallelIncrementalLUT::apply(const uint* image_data, uint* screen)
+{
+    run_parallel(Range(0, geometry.screen.height), [&](const Range& range){
+        warp_rows(image_data, screen, range);
+    }, n_threads);
+}
+
+
+PlainMeshLUT::PlainMeshLUT(const Warp& warp, const Geometry& geometry, uint* datastart, int grid)
+    : MeshLUT(warp, geometry, datastart, grid)
+{
+}
+
+void PlainMeshLUT::apply(const uint* image_data, uint* screen)
+{
+    warp_rows(image_data, screen, Range(0, geometry.screen.height));
+}
+
+void PlainMeshLUT::apply_batch(const uint* const* images, uint* const* screens, int count)
+{
+    warp_rows_batch(images, screens, count, Range(0, geometry.screen.height));
+}
+
+
+ParallelMeshLUT::ParallelMeshLUT(const Warp& warp, const Geometry& geometry, uint* datastart, int grid)
+    : MeshLUT(warp, geometry, datastart, grid)
+{
+    n_threads = getNumThreads();
+}
+
+void ParallelMeshLUT::apply(const uint* image_data, uint* screen)
+{
+    run_parallel(Range(0, geometry.screen.height), [&](const Range& range){
+        warp_rows(image_data, screen, range);
+    }, n_threads);
+}
+
+void ParallelMeshLUT::apply_batch(const uint* const* images, uint* const* screens, int count)
+{
+    run_parallel(Range(0, geometry.screen.height), [&](const Range& range){
+        warp_rows_batch(images, screens, count, range);
+    }, n_threads);
+}
+
+
+PlainSpanLUT::PlainSpanLUT(const Warp& warp, const Geometry& geometry, uint* datastart)
+    : SpanLUT(warp, geometry, datastart)
+{
+}
+
+void PlainSpanLUT::apply(const uint* image_data, uint* screen)
+{
+    for (const Span& span : spans)
     {
-        for (int x = 0; x < width; x++)
+        copy_span(image_data, screen, span);
+    }
+}
+
+
+ParallelSpanLUT::ParallelSpanLUT(const Warp& warp, const Geometry& geometry, uint* datastart)
+    : SpanLUT(warp, geometry, datastart)
+{
+    n_threads = getNumThreads();
+}
+
+void ParallelSpanLUT::apply(const uint* image_data, uint* screen)
+{
+    const Span* span_data = spans.data();
+
+    /* spans never share a screen pixel, so the order between threads does not matter */
+    run_parallel(Range(0, static_cast<int>(spans.size())), [&](const Range& range){
+        for (int r = range.start; r < range.end; r++)
         {
-            coordinates_map.push_back(Point2f(x, y));
+            copy_span(image_data, screen, span_data[r]);
         }
+    }, n_threads);
+}
+
+
+PlainTiledLUT::PlainTiledLUT(const Warp& warp, const Geometry& geometry, uint* datastart, Size tile_size)
+    : TiledLUT(warp, geometry, datastart, tile_size)
+{
+}
+
+void PlainTiledLUT::apply(const uint* image_data, uint* screen)
+{
+    apply_tiles(image_data, screen, Range(0, static_cast<int>(tile_begin.size()) - 1));
+}
+
+
+ParallelTiledLUT::ParallelTiledLUT(const Warp& warp, const Geometry& geometry, uint* datastart, Size tile_size)
+    : TiledLUT(warp, geometry, datastart, tile_size)
+{
+    n_threads = getNumThreads();
+}
+
+void ParallelTiledLUT::apply(const uint* image_data, uint* screen)
+{
+    run_parallel(Range(0, static_cast<int>(tile_begin.size()) - 1), [&](const Range& range){
+        apply_tiles(image_data, screen, range);
+    }, n_threads);
+}
+
+
+SimdReverseLUT::SimdReverseLUT(const Warp& warp, const Geometry& geometry, uint* datastart, SimdISA isa)
+    : ReverseLUT(warp, geometry, datastart), isa(isa)
+{
+    select_kernel();
+}
+
+SimdReverseLUT::SimdReverseLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart, SimdISA isa)
+    : ReverseLUT(file, geometry, datastart), isa(isa)
+{
+    select_kernel();
+}
+
+void SimdReverseLUT::select_kernel()
+{
+    switch (isa)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+    case SimdISA::SSE41: kernel = gather_sse41; break;
+    case SimdISA::AVX2: kernel = gather_avx2; break;
+    case SimdISA::AVX512: kernel = gather_avx512; break;
+#endif
+    default: kernel = gather_scalar; isa = SimdISA::SCALAR; break;
     }
+}
 
-    perspectiveTransform(coordinates_map, coordinates_map, transform_matrix);
+string SimdReverseLUT::summary() const
+{
+    return string("gather kernel : ") + simd_isa_name(isa);
+}
 
-    for (int i = 0; i < table_size; i++)
+
+PlainSimdReverseLUT::PlainSimdReverseLUT(const Warp& warp, const Geometry& geometry, uint* datastart, SimdISA isa)
+    : SimdReverseLUT(warp, geometry, datastart, isa)
+{
+}
+
+PlainSimdReverseLUT::PlainSimdReverseLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart, SimdISA isa)
+    : SimdReverseLUT(file, geometry, datastart, isa)
+{
+}
+
+void PlainSimdReverseLUT::apply(const uint* image_data, uint* screen)
+{
+    kernel(lookup_table.get(), image_data, screen, table_size);
+}
+
+
+ParallelSimdReverseLUT::ParallelSimdReverseLUT(const Warp& warp, const Geometry& geometry, uint* datastart, SimdISA isa)
+    : SimdReverseLUT(warp, geometry, datastart, isa)
+{
+    n_threads = getNumThreads();
+}
+
+ParallelSimdReverseLUT::ParallelSimdReverseLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart, SimdISA isa)
+    : SimdReverseLUT(file, geometry, datastart, isa)
+{
+    n_threads = getNumThreads();
+}
+
+void ParallelSimdReverseLUT::apply(const uint* image_data, uint* screen)
+{
+    const uint32_t* lut = lookup_table.get();
+
+    run_parallel(Range(0, table_size), [&](const Range& range){
+        kernel(lut + range.start, image_data, screen + range.start, range.end - range.start);
+    }, n_threads, CACHE_LINE_PIXELS);
+}
+
+
+SimdOffsetLUT::SimdOffsetLUT(const Warp& warp, const Geometry& geometry, uint* datastart, SimdISA isa)
+    : OffsetLUT(warp, geometry, datastart), isa(isa)
+{
+    select_kernel();
+}
+
+SimdOffsetLUT::SimdOffsetLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart, SimdISA isa)
+    : OffsetLUT(file, geometry, datastart), isa(isa)
+{
+    select_kernel();
+}
+
+void SimdOffsetLUT::select_kernel()
+{
+    switch (isa)
     {
-        Point2i point = Point2i(static_cast<int>(roundf(coordinates_map[i].x)), static_cast<int>(roundf(coordinates_map[i].y)));
-        int offset = point.y * width + point.x;
-        lookup_table[i] = datastart + offset;
+#if defined(__x86_64__) || defined(__i386__)
+    case SimdISA::AVX512: kernel = scatter_avx512; break;
+#endif
+    default: kernel = scatter_scalar; isa = SimdISA::SCALAR; break;
     }
 }
 
+string SimdOffsetLUT::summary() const
+{
+    return string("scatter kernel : ") + simd_isa_name(isa) + ", " + OffsetLUT::summary();
+}
 
-PlainLUT::PlainLUT(Mat transform_matrix, int width, int height, uint* datastart)
-    : LUT(transform_matrix, width, height, datastart)
+
+PlainSimdOffsetLUT::PlainSimdOffsetLUT(const Warp& warp, const Geometry& geometry, uint* datastart, SimdISA isa)
+    : SimdOffsetLUT(warp, geometry, datastart, isa)
 {
 }
 
-void PlainLUT::apply(const uint* image_data)
+PlainSimdOffsetLUT::PlainSimdOffsetLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart, SimdISA isa)
+    : SimdOffsetLUT(file, geometry, datastart, isa)
 {
-    uint** lut = lookup_table.get();
+}
 
-    for (int i = 0; i < table_size; i++)
+void PlainSimdOffsetLUT::apply(const uint* image_data, uint* screen)
+{
+    const uint32_t* lut = lookup_table.get();
+
+    for (const VisibleRuns::Run& run : visible.runs)
     {
-        **lut++ = *image_data++;
+        kernel(lut + run.entry, image_data + run.src_offset, screen, run.length);
     }
 }
 
 
-ParallelLUT::ParallelLUT(Mat transform_matrix, int width, int height, uint* datastart)
-    : LUT(transform_matrix, width, height, datastart)
+ParallelSimdOffsetLUT::ParallelSimdOffsetLUT(const Warp& warp, const Geometry& geometry, uint* datastart, SimdISA isa)
+    : SimdOffsetLUT(warp, geometry, datastart, isa)
 {
     n_threads = getNumThreads();
 }
 
-void ParallelLUT::apply(const uint* image_data)
+ParallelSimdOffsetLUT::ParallelSimdOffsetLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart, SimdISA isa)
+    : SimdOffsetLUT(file, geometry, datastart, isa)
 {
-    uint** lut = lookup_table.get();
+    n_threads = getNumThreads();
+}
 
-    parallel_for_(Range(0, table_size), [&](const Range& range){
-        uint** lut_partial = lut + range.start;
-        const uint* image_partial = image_data + range.start;
-        for (int r = range.start; r < range.end; r++)
+void ParallelSimdOffsetLUT::apply(const uint* image_data, uint* screen)
+{
+    const uint32_t* lut = lookup_table.get();
+
+    run_parallel(Range(0, table_size), [&](const Range& range){
+        visible.for_each(range, [&](int entry, int src_offset, int length){
+            kernel(lut + entry, image_data + src_offset, screen, length);
+        });
+    }, n_threads, CACHE_LINE_PIXELS);
+}
+
+
+PlainBilinearLUT::PlainBilinearLUT(const Warp& warp, const Geometry& geometry, uint* datastart)
+    : BilinearLUT(warp, geometry, datastart)
+{
+}
+
+void PlainBilinearLUT::apply(const uint* image_data, uint* screen)
+{
+    const uint32_t* lut = lookup_table.get();
+
+    with_fixed_size(table_size, [&](auto count){
+        for (int i = 0; i < count; i++)
         {
-            **lut_partial++ = *image_partial++;
+            uint32_t entry = *lut++;
+            *screen++ = entry == NO_SOURCE ? 0 : blend(image_data, source_stride, entry);
         }
-    }, n_threads);
+    });
+}
+
+void PlainBilinearLUT::apply_batch(const uint* const* images, uint* const* screens, int count)
+{
+    blend_batch(images, screens, count, Range(0, table_size));
 }
 
 
-#ifdef __arm__
-LoadStoreMultipleLUT::LoadStoreMultipleLUT(Mat transform_matrix, int width, int height, uint* datastart)
-    : LUT(transform_matrix, width, height, datastart)
+ParallelBilinearLUT::ParallelBilinearLUT(const Warp& warp, const Geometry& geometry, uint* datastart)
+    : BilinearLUT(warp, geometry, datastart)
 {
+    n_threads = getNumThreads();
 }
 
-void LoadStoreMultipleLUT::apply(const uint* image_data)
+void ParallelBilinearLUT::apply(const uint* image_data, uint* screen)
 {
-    uint** lut = lookup_table.get();
+    const uint32_t* lut = lookup_table.get();
+
+    run_parallel(Range(0, table_size), [&](const Range& range){
+        const uint32_t* lut_partial = lut + range.start;
+        uint* screen_partial = screen + range.start;
+        for (int r = range.start; r < range.end; r++)
+        {
+            uint32_t entry = *lut_partial++;
+            *screen_partial++ = entry == NO_SOURCE ? 0 : blend(image_data, source_stride, entry);
+        }
+    }, n_threads, CACHE_LINE_PIXELS);
+}
+
+void ParallelBilinearLUT::apply_batch(const uint* const* images, uint* const* screens, int count)
+{
+    run_parallel(Range(0, table_size), [&](const Range& range){
+        blend_batch(images, screens, count, range);
+    }, n_threads, CACHE_LINE_PIXELS);
+}
+
+
+PlainFormatLUT::PlainFormatLUT(const Warp& warp, const Geometry& geometry, uint* datastart, PixelFormat format)
+    : FormatLUT(warp, geometry, datastart, format)
+{
+}
 
-    __asm__ volatile (
-        "mov     r0, %[table_size]\n"
-        ".lsmloop:\n\t"
-        "ldmia   %[image_data]!, {r1-r4}\n\t"
-        "ldmia   %[lut]!, {r5-r8}\n\t"
-        "str     r1, [r5]\n\t"
-        "str     r2, [r6]\n\t"
-        "str     r3, [r7]\n\t"
-        "str     r4, [r8]\n\t"
-        "subs    r0, #4\n\t"
-        "bgt     .lsmloop\n\t"
-        :
-        : [lut]"r" (lut), [image_data]"r" (image_data), [table_size]"r" (table_size)
-        : "cc", "memory", "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7", "r8"
-    );
+void PlainFormatLUT::apply(const uint* image_data, uint* screen)
+{
+    apply_rows(image_data, screen, Range(0, row_groups));
 }
 
 
-ParallelLoadStoreMultipleLUT::ParallelLoadStoreMultipleLUT(Mat transform_matrix, int width, int height, uint* datastart)
-    : LUT(transform_matrix, width, height, datastart)
+ParallelFormatLUT::ParallelFormatLUT(const Warp& warp, const Geometry& geometry, uint* datastart, PixelFormat format)
+    : FormatLUT(warp, geometry, datastart, format)
 {
     n_threads = getNumThreads();
 }
 
-void ParallelLoadStoreMultipleLUT::apply(const uint* image_data)
+void ParallelFormatLUT::apply(const uint* image_data, uint* screen)
 {
-    uint** lut = lookup_table.get();
+    run_parallel(Range(0, row_groups), [&](const Range& range){
+        apply_rows(image_data, screen, range);
+    }, n_threads);
+}
 
-    parallel_for_(Range(0, table_size), [&](const Range& range){
+
+#ifdef __arm__
+/* the LDM loop moves four pixels at a time; the remaining 0-3 pixels are handled by the scalar tail */
+static void copy_load_store_multiple(uint** lut, const uint* image_data, int length)
+{
+    int count = length & ~3;
+
+    if (count > 0)
+    {
         __asm__ volatile (
-            "add     %[lut], %[lut], %[start], LSL #2\n\t"
-            "add     %[image_data], %[image_data], %[start], LSL #2\n\t"
-            "mov     r0, %[start]\n"
-            ".plsmloop:\n\t"
-            "cmp     r0, %[end]\n\t"
-            "bge     .plsmexit\n\t"
+            "1:\n\t"
             "ldmia   %[image_data]!, {r1-r4}\n\t"
             "ldmia   %[lut]!, {r5-r8}\n\t"
             "str     r1, [r5]\n\t"
             "str     r2, [r6]\n\t"
             "str     r3, [r7]\n\t"
             "str     r4, [r8]\n\t"
-            "add     r0, #4\n\t"
-            "b       .plsmloop\n"
-            ".plsmexit:"
+            "subs    %[count], %[count], #4\n\t"
+            "bgt     1b\n\t"
+            : [lut]"+r" (lut), [image_data]"+r" (image_data), [count]"+r" (count)
             :
-            : [lut]"r" (lut), [image_data]"r" (image_data), [start]"r" (range.start), [end]"r" (range.end)
-            : "cc", "memory", "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7", "r8"
+            : "cc", "memory", "r1", "r2", "r3", "r4", "r5", "r6", "r7", "r8"
         );
-    }, n_threads);
+    }
+
+    for (int i = length & ~3; i < length; i++)
+    {
+        **lut++ = *image_data++;
+    }
+}
+
+
+LoadStoreMultipleLUT::LoadStoreMultipleLUT(const Warp& warp, const Geometry& geometry, uint* datastart)
+    : PointerLUT(warp, geometry, datastart)
+{
+}
+
+void LoadStoreMultipleLUT::apply(const uint* image_data)
+{
+    for (const VisibleRuns::Run& run : visible.runs)
+    {
+        copy_load_store_multiple(lookup_table.get() + run.entry, image_data + run.src_offset, run.length);
+    }
+}
+
+
+ParallelLoadStoreMultipleLUT::ParallelLoadStoreMultipleLUT(const Warp& warp, const Geometry& geometry, uint* datastart)
+    : PointerLUT(warp, geometry, datastart)
+{
+    n_threads = getNumThreads();
+}
+
+void ParallelLoadStoreMultipleLUT::apply(const uint* image_data)
+{
+    uint** lut = lookup_table.get();
+
+    run_parallel(Range(0, table_size), [&](const Range& range){
+        visible.for_each(range, [&](int entry, int src_offset, int length){
+            copy_load_store_multiple(lut + entry, image_data + src_offset, length);
+        });
+    }, n_threads, CACHE_LINE_PIXELS);
 }
 #endif
 
@@ -1,68 +1,650 @@
 #pragma once
 
+#include <algorithm>
+#include <functional>
+#include <memory>
 #include <vector>
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "warp.hpp"
+
 using namespace std;
 using namespace cv;
 
 constexpr auto DISPLAY_W = 1920;
 constexpr auto DISPLAY_H = 1080;
+constexpr auto CACHE_LINE_PIXELS = 16;     // 32-bit pixels or table entries per 64-byte cache line
 
 
 namespace ins
 {
 
 
-Mat get_transform_matrix(vector<Point2f> desired_points);
+class LUTProfiler;
+class MappedLUTFile;
+class ThreadPool;
+
+
+/* Layout of the source image and the screen; strides are in pixels and default to the width
+ */
+struct Geometry
+{
+    Size source;
+    Size screen;
+    int source_stride;
+    int screen_stride;
+
+    Geometry(int width, int height);
+    Geometry(Size source, Size screen, int source_stride = 0, int screen_stride = 0);
+    int screen_buffer_size() const { return screen_stride * screen.height; }
+};
+
+
+Mat get_transform_matrix(vector<Point2f> desired_points, Size source_size = Size(DISPLAY_W, DISPLAY_H));
+
+/* Screen offset of every source pixel, the mapping the scatter tables are built from; -1 where the pixel lands off screen
+ */
+vector<int> transform_offsets(const Warp& warp, const Geometry& geometry);
+
+/* Source offset of every screen pixel (stride padding included), the mapping ReverseLUT is built from;
+ * -1 where the screen pixel has no source pixel
+ */
+vector<int> inverse_offsets(const Warp& warp, const Geometry& geometry);
+
+
+enum class SimdISA
+{
+    SCALAR,
+    SSE41,
+    AVX2,
+    AVX512
+};
+
+SimdISA detect_simd_isa();
+const char* simd_isa_name(SimdISA isa);
+
+
+/* Frame layouts FormatLUT can warp without converting to BGRA first;
+ * NV12 and I420 are 4:2:0 planar YUV with the chroma planes following the luma plane.
+ */
+enum class PixelFormat
+{
+    BGRA32,
+    BGR24,
+    RGB565,
+    GRAY8,
+    NV12,
+    I420
+};
+
+const char* pixel_format_name(PixelFormat format);
+bool is_planar_yuv(PixelFormat format);
+
+
+/* The parallel loop shared by the LUTs and the other per-frame passes: cv::parallel_for_ with n_threads stripes, or
+ * the thread pool when one is given, which keeps the partition boundaries at multiples of align; with a profiler, the
+ * hardware counters of each partition's thread are read around the partition
+ */
+void run_parallel(ThreadPool* pool, LUTProfiler* profiler, const Range& range, const function<void(const Range&)>& body,
+                  int n_threads, int align = 1);
 
 
 class LUT
 {
 protected:
-    unique_ptr<uint*[]> lookup_table;
     int table_size;
-    LUT(Mat transform_matrix, int width, int height, uint* datastart);
+    shared_ptr<ThreadPool> pool;
+    shared_ptr<LUTProfiler> profiler;
+    LUT(int table_size);
+
+    /* the per-frame loop of the parallel methods, on the pool and profiler set for this LUT */
+    void run_parallel(const Range& range, const function<void(const Range&)>& body, int n_threads, int align = 1) const;
 public:
     virtual ~LUT() {}
     virtual void apply(const uint* image_data) = 0;
+    virtual string summary() const { return string(); }
+    virtual int size() const { return table_size; }
+
+    /* nullptr goes back to OpenCV's parallel backend */
+    void set_thread_pool(shared_ptr<ThreadPool> pool) { this->pool = pool; }
+    /* nullptr stops profiling */
+    void set_profiler(shared_ptr<LUTProfiler> profiler) { this->profiler = profiler; }
+};
+
+
+/* Source pixels that land on screen, as runs of consecutive source offsets.
+ * Clipped scatter tables store one entry per visible pixel only, in source order; run.entry is the table index
+ * of the run's first pixel.
+ */
+struct VisibleRuns
+{
+    struct Run
+    {
+        int entry;
+        int src_offset;
+        int length;
+    };
+    vector<Run> runs;
+    int n_source = 0;
+    int n_visible = 0;
+
+    /* appends source pixel src_offset, which must be greater than any pixel added before */
+    void add(int src_offset);
+    string summary() const;
+
+    /* calls body(entry, src_offset, length) for the pieces of the runs inside the entry range */
+    template<typename Body>
+    void for_each(const Range& entries, Body body) const
+    {
+        auto run = upper_bound(runs.begin(), runs.end(), entries.start, [](int entry, const Run& r){ return entry < r.entry; });
+        if (run != runs.begin())
+            --run;
+        for (; run != runs.end() && run->entry < entries.end; ++run)
+        {
+            int begin = max(entries.start, run->entry);
+            int end = min(entries.end, run->entry + run->length);
+            if (begin < end)
+                body(begin, run->src_offset + (begin - run->entry), end - begin);
+        }
+    }
+};
+
+
+/* Table of raw screen addresses, bound to the screen buffer at construction time
+ *
+ * Scatter tables (pointer, offset, span, tiled) are indexed by source pixel and need a packed source;
+ * source pixels that land off screen are clipped away, so they cost nothing and are never written.
+ * Gather tables (reverse, incremental, bilinear) have one entry per screen pixel including the stride padding.
+ */
+class PointerLUT : public LUT
+{
+protected:
+    unique_ptr<uint*[]> lookup_table;
+    VisibleRuns visible;
+    PointerLUT(const Warp& warp, const Geometry& geometry, uint* datastart);
+public:
+    string summary() const override;
+};
+
+
+/* A LUT that can be applied to any screen buffer of the same geometry;
+ * apply(image_data) writes into the buffer given at construction time.
+ */
+class RelocatableLUT : public LUT
+{
+protected:
+    uint* datastart;
+    RelocatableLUT(int table_size, uint* datastart);
+public:
+    void apply(const uint* image_data) override;
+    virtual void apply(const uint* image_data, uint* screen) = 0;
+
+    /* warps count frames, images[k] into screens[k], with one pass over the table: the table-driven methods load
+     * each entry once and apply it to every frame; the others call apply once per frame
+     */
+    virtual void apply_batch(const uint* const* images, uint* const* screens, int count);
+};
+
+
+/* Table of 32-bit screen offsets; half the size of PointerLUT on 64-bit builds
+ *
+ * File layout: source pixel count, run count, (src_offset, length) per run, then the offsets of the visible pixels.
+ */
+class OffsetLUT : public RelocatableLUT
+{
+protected:
+    shared_ptr<const uint32_t> lookup_table;
+    VisibleRuns visible;
+    OffsetLUT(const Warp& warp, const Geometry& geometry, uint* datastart);
+    OffsetLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart);
+    void scatter_batch(const uint* const* images, uint* const* screens, int count, const Range& entries) const;
+public:
+    static constexpr uint32_t FILE_KIND = 3;
+    void save(const string& path, uint64_t key) const;
+    string summary() const override;
+};
+
+
+/* Destination-ordered (gather) table of 32-bit source offsets built from the screen-to-source direction of the warp;
+ * screen pixels with no source pixel are cleared to zero.
+ */
+class ReverseLUT : public RelocatableLUT
+{
+protected:
+    shared_ptr<const uint32_t> lookup_table;
+    ReverseLUT(const Warp& warp, const Geometry& geometry, uint* datastart);
+    ReverseLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart);
+    void gather_batch(const uint* const* images, uint* const* screens, int count, const Range& range) const;
+public:
+    static constexpr uint32_t NO_SOURCE = 0xFFFFFFFF;
+    static constexpr uint32_t FILE_KIND = 2;
+    void save(const string& path, uint64_t key) const;
+};
+
+
+/* Table-free gather: source coordinates are computed per screen row by incrementally adding
+ * the derivatives of the inverse homography. With span > 1 the projective division is done only
+ * at every span-th pixel and the coordinates in between are interpolated linearly. Needs a homography warp.
+ */
+class IncrementalLUT : public RelocatableLUT
+{
+protected:
+    Matx33d inverse_matrix;
+    Geometry geometry;
+    int span;
+    IncrementalLUT(const Warp& warp, const Geometry& geometry, uint* datastart, int span);
+    void warp_rows(const uint* image_data, uint* screen, const Range& rows) const;
 };
 
 
-class PlainLUT : public LUT
+/* Gather from a sparse grid: exact source coordinates are kept only at every grid-th screen pixel in both directions
+ * (and at the last row and column), and the coordinates in between are interpolated bilinearly in 16.16 fixed point,
+ * stepping incrementally along each row segment. The table is about grid^2 times smaller than ReverseLUT and stays
+ * cache-resident; the price is a small deviation from the exact mapping, which error() measures.
+ */
+class MeshLUT : public RelocatableLUT
 {
+protected:
+    struct Node
+    {
+        int32_t x, y;   // source coordinates in 16.16 fixed point
+    };
+    vector<Node> nodes;
+    Warp warp;
+    Geometry geometry;
+    int grid;
+    int nodes_x, nodes_y;
+    MeshLUT(const Warp& warp, const Geometry& geometry, uint* datastart, int grid);
+    void warp_rows(const uint* image_data, uint* screen, const Range& rows) const;
+    void warp_rows_batch(const uint* const* images, uint* const* screens, int count, const Range& rows) const;
+
+    /* calls visit(x, y, sx, sy) with the interpolated fixed-point source coordinates of every screen pixel of the rows */
+    template<typename Visit>
+    void for_each_coordinate(const Range& rows, Visit visit) const;
 public:
-    PlainLUT(Mat transform_matrix, int width, int height, uint* datastart);
+    struct Error
+    {
+        double mean_px;         // distance to the exact source coordinates, over screen pixels with a source pixel
+        double max_px;
+        double mismatched;      // fraction of screen pixels that sample another source pixel than ReverseLUT
+    };
+    /* a full-screen pass against the exact coordinates; measured on the first call and kept, and reported by
+     * summary() from then on
+     */
+    Error error() const;
+    size_t table_bytes() const { return nodes.size() * sizeof(Node); }
+    string summary() const override;
+
+private:
+    mutable bool has_error = false;
+    mutable Error measured_error;
+};
+
+
+/* Scatter table compressed into runs of consecutive source pixels landing on consecutive screen pixels.
+ * Entries overwritten by a later source pixel are dropped, so the output matches PlainLUT.
+ */
+class SpanLUT : public RelocatableLUT
+{
+protected:
+    struct Span
+    {
+        uint32_t dst_offset;
+        uint32_t src_offset;
+        uint32_t length;
+    };
+    vector<Span> spans;
+    int n_visible;      // entries a clipped OffsetLUT would have
+    SpanLUT(const Warp& warp, const Geometry& geometry, uint* datastart);
+    static void copy_span(const uint* image_data, uint* screen, const Span& span);
+public:
+    /* 32-bit words stored for the spans, the unit of the OffsetLUT entries they replace */
+    int size() const override { return static_cast<int>(spans.size() * (sizeof(Span) / sizeof(uint32_t))); }
+    double compression_ratio() const;
+    string summary() const override;
+};
+
+
+/* Scatter table of (src, dst) pairs grouped by screen tile. Within a tile the pairs stay in source order,
+ * so reads and writes of one tile stay in cache and each tile can be handed to a single thread.
+ */
+class TiledLUT : public RelocatableLUT
+{
+protected:
+    struct Entry
+    {
+        uint32_t src_offset;
+        uint32_t dst_offset;
+    };
+    unique_ptr<Entry[]> lookup_table;
+    vector<int> tile_begin;
+    int n_entries;
+    TiledLUT(const Warp& warp, const Geometry& geometry, uint* datastart, Size tile_size);
+    void apply_tiles(const uint* image_data, uint* screen, const Range& tiles) const;
+public:
+    string summary() const override;
+};
+
+
+/* Destination-ordered table for bilinear sampling. Each entry packs the offset of the top-left source pixel
+ * in the upper 24 bits and 4-bit horizontal/vertical weights in the lower 8 bits.
+ */
+class BilinearLUT : public RelocatableLUT
+{
+protected:
+    unique_ptr<uint32_t[]> lookup_table;
+    int source_stride;
+    BilinearLUT(const Warp& warp, const Geometry& geometry, uint* datastart);
+    static uint blend(const uint* image_data, int source_stride, uint32_t entry);
+    void blend_batch(const uint* const* images, uint* const* screens, int count, const Range& range) const;
+public:
+    static constexpr uint32_t NO_SOURCE = 0xFFFFFFFF;
+};
+
+
+/* Gather tables for frames in their native pixel format; the table holds pixel offsets, so one table serves
+ * every pixel size. Planar YUV gathers the luma plane with the full-resolution table and both chroma planes
+ * with a second table built for the half-resolution chroma grid.
+ * image_data and screen point to the first byte of the frame; strides in the geometry are in pixels of the first plane.
+ */
+class FormatLUT : public RelocatableLUT
+{
+protected:
+    PixelFormat format;
+    Geometry geometry;
+    unique_ptr<uint32_t[]> lookup_table;
+    unique_ptr<uint32_t[]> chroma_table;
+    int row_groups;     // screen rows, or pairs of luma rows sharing one chroma row
+    FormatLUT(const Warp& warp, const Geometry& geometry, uint* datastart, PixelFormat format);
+    void apply_rows(const uint* image_data, uint* screen, const Range& rows) const;
+public:
+    static constexpr uint32_t NO_SOURCE = 0xFFFFFFFF;
+    string summary() const override;
+};
+
+
+class PlainLUT : public PointerLUT
+{
+public:
+    PlainLUT(const Warp& warp, const Geometry& geometry, uint* datastart);
     void apply(const uint* image_data) override;
 };
 
 
-class ParallelLUT : public LUT
+class ParallelLUT : public PointerLUT
 {
 private:
     int n_threads;
 public:
-    ParallelLUT(Mat transform_matrix, int width, int height, uint* datastart);
+    ParallelLUT(const Warp& warp, const Geometry& geometry, uint* datastart);
     void apply(const uint* image_data) override;
 };
 
 
+class PlainOffsetLUT : public OffsetLUT
+{
+public:
+    PlainOffsetLUT(const Warp& warp, const Geometry& geometry, uint* datastart);
+    PlainOffsetLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart);
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+    void apply_batch(const uint* const* images, uint* const* screens, int count) override;
+};
+
+
+class ParallelOffsetLUT : public OffsetLUT
+{
+private:
+    int n_threads;
+public:
+    ParallelOffsetLUT(const Warp& warp, const Geometry& geometry, uint* datastart);
+    ParallelOffsetLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart);
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+    void apply_batch(const uint* const* images, uint* const* screens, int count) override;
+};
+
+
+class PlainReverseLUT : public ReverseLUT
+{
+public:
+    PlainReverseLUT(const Warp& warp, const Geometry& geometry, uint* datastart);
+    PlainReverseLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart);
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+    void apply_batch(const uint* const* images, uint* const* screens, int count) override;
+};
+
+
+class ParallelReverseLUT : public ReverseLUT
+{
+protected:
+    int n_threads;
+public:
+    ParallelReverseLUT(const Warp& warp, const Geometry& geometry, uint* datastart);
+    ParallelReverseLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart);
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+    void apply_batch(const uint* const* images, uint* const* screens, int count) override;
+};
+
+
+class PlainIncrementalLUT : public IncrementalLUT
+{
+public:
+    PlainIncrementalLUT(const Warp& warp, const Geometry& geometry, uint* datastart, int span = 1);
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+};
+
+
+class ParallelIncrementalLUT : public IncrementalLUT
+{
+private:
+    int n_threads;
+public:
+    ParallelIncrementalLUT(const Warp& warp, const Geometry& geometry, uint* datastart, int span = 1);
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+};
+
+
+class PlainMeshLUT : public MeshLUT
+{
+public:
+    PlainMeshLUT(const Warp& warp, const Geometry& geometry, uint* datastart, int grid = 16);
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+    void apply_batch(const uint* const* images, uint* const* screens, int count) override;
+};
+
+
+class ParallelMeshLUT : public MeshLUT
+{
+private:
+    int n_threads;
+public:
+    ParallelMeshLUT(const Warp& warp, const Geometry& geometry, uint* datastart, int grid = 16);
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+    void apply_batch(const uint* const* images, uint* const* screens, int count) override;
+};
+
+
+class PlainSpanLUT : public SpanLUT
+{
+public:
+    PlainSpanLUT(const Warp& warp, const Geometry& geometry, uint* datastart);
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+};
+
+
+class ParallelSpanLUT : public SpanLUT
+{
+private:
+    int n_threads;
+public:
+    ParallelSpanLUT(const Warp& warp, const Geometry& geometry, uint* datastart);
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+};
+
+
+class PlainTiledLUT : public TiledLUT
+{
+public:
+    PlainTiledLUT(const Warp& warp, const Geometry& geometry, uint* datastart, Size tile_size = Size(64, 64));
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+};
+
+
+class ParallelTiledLUT : public TiledLUT
+{
+private:
+    int n_threads;
+public:
+    ParallelTiledLUT(const Warp& warp, const Geometry& geometry, uint* datastart, Size tile_size = Size(64, 64));
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+};
+
+
+/* Vectorized gather over the reverse LUT; the kernel is picked at construction time from what the CPU supports
+ */
+class SimdReverseLUT : public ReverseLUT
+{
+protected:
+    typedef void (*Kernel)(const uint32_t* lut, const uint* image_data, uint* screen, int count);
+    Kernel kernel;
+    SimdISA isa;
+    void select_kernel();
+    SimdReverseLUT(const Warp& warp, const Geometry& geometry, uint* datastart, SimdISA isa);
+    SimdReverseLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart, SimdISA isa);
+public:
+    string summary() const override;
+};
+
+
+class PlainSimdReverseLUT : public SimdReverseLUT
+{
+public:
+    PlainSimdReverseLUT(const Warp& warp, const Geometry& geometry, uint* datastart, SimdISA isa = detect_simd_isa());
+    PlainSimdReverseLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart, SimdISA isa = detect_simd_isa());
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+};
+
+
+class ParallelSimdReverseLUT : public SimdReverseLUT
+{
+private:
+    int n_threads;
+public:
+    ParallelSimdReverseLUT(const Warp& warp, const Geometry& geometry, uint* datastart, SimdISA isa = detect_simd_isa());
+    ParallelSimdReverseLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart, SimdISA isa = detect_simd_isa());
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+};
+
+
+/* Vectorized scatter over the offset LUT; only AVX-512 has a scatter instruction, other ISAs use the scalar loop
+ */
+class SimdOffsetLUT : public OffsetLUT
+{
+protected:
+    typedef void (*Kernel)(const uint32_t* lut, const uint* image_data, uint* screen, int count);
+    Kernel kernel;
+    SimdISA isa;
+    void select_kernel();
+    SimdOffsetLUT(const Warp& warp, const Geometry& geometry, uint* datastart, SimdISA isa);
+    SimdOffsetLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart, SimdISA isa);
+public:
+    string summary() const override;
+};
+
+
+class PlainSimdOffsetLUT : public SimdOffsetLUT
+{
+public:
+    PlainSimdOffsetLUT(const Warp& warp, const Geometry& geometry, uint* datastart, SimdISA isa = detect_simd_isa());
+    PlainSimdOffsetLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart, SimdISA isa = detect_simd_isa());
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+};
+
+
+class ParallelSimdOffsetLUT : public SimdOffsetLUT
+{
+private:
+    int n_threads;
+public:
+    ParallelSimdOffsetLUT(const Warp& warp, const Geometry& geometry, uint* datastart, SimdISA isa = detect_simd_isa());
+    ParallelSimdOffsetLUT(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* datastart, SimdISA isa = detect_simd_isa());
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+};
+
+
+class PlainBilinearLUT : public BilinearLUT
+{
+public:
+    PlainBilinearLUT(const Warp& warp, const Geometry& geometry, uint* datastart);
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+    void apply_batch(const uint* const* images, uint* const* screens, int count) override;
+};
+
+
+class ParallelBilinearLUT : public BilinearLUT
+{
+private:
+    int n_threads;
+public:
+    ParallelBilinearLUT(const Warp& warp, const Geometry& geometry, uint* datastart);
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+    void apply_batch(const uint* const* images, uint* const* screens, int count) override;
+};
+
+
+class PlainFormatLUT : public FormatLUT
+{
+public:
+    PlainFormatLUT(const Warp& warp, const Geometry& geometry, uint* datastart, PixelFormat format = PixelFormat::BGRA32);
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+};
+
+
+class ParallelFormatLUT : public FormatLUT
+{
+private:
+    int n_threads;
+public:
+    ParallelFormatLUT(const Warp& warp, const Geometry& geometry, uint* datastart, PixelFormat format = PixelFormat::BGRA32);
+    using RelocatableLUT::apply;
+    void apply(const uint* image_data, uint* screen) override;
+};
+
+
 #ifdef __arm__
-class LoadStoreMultipleLUT : public LUT
+class LoadStoreMultipleLUT : public PointerLUT
 {
 public:
-    LoadStoreMultipleLUT(Mat transform_matrix, int width, int height, uint* datastart);
+    LoadStoreMultipleLUT(const Warp& warp, const Geometry& geometry, uint* datastart);
     void apply(const uint* image_data) override;
 };
 
 
-class ParallelLoadStoreMultipleLUT : public LUT
+class ParallelLoadStoreMultipleLUT : public PointerLUT
 {
 private:
     int n_threads;
 public:
-    ParallelLoadStoreMultipleLUT(Mat transform_matrix, int width, int height, uint* datastart);
+    ParallelLoadStoreMultipleLUT(const Warp& warp, const Geometry& geometry, uint* datastart);
     void apply(const uint* image_data) override;
 };
 #endif
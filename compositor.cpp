@@ -0,0 +1,141 @@
+#include <cstdio>
+
+#include "compositor.hpp"
+
+
+namespace ins
+{
+
+
+CompositeSurface::CompositeSurface(Mat transform_matrix, Size source, int z, int source_stride)
+    : transform_matrix(transform_matrix), source(source), source_stride(source_stride), z(z)
+{
+}
+
+
+Compositor::Compositor(const vector<CompositeSurface>& surfaces, Size screen, int screen_stride, Size tile_size)
+    : screen(screen), screen_stride(screen_stride > 0 ? screen_stride : screen.width), n_threads(getNumThreads())
+{
+    CV_Assert(!surfaces.empty() && tile_size.width > 0 && tile_size.height > 0);
+
+    int screen_size = this->screen_stride * screen.height;
+    lookup_table = unique_ptr<uint32_t[]>(new uint32_t[screen_size]);
+    vector<int> owner(screen_size, -1);
+    surface_pixels.assign(surfaces.size(), 0);
+
+    /* from the top surface down, each screen pixel is taken by the first surface that covers it */
+    vector<int> order(surfaces.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = static_cast<int>(i);
+    stable_sort(order.begin(), order.end(), [&](int a, int b){ return surfaces[a].z > surfaces[b].z; });
+
+    for (int s : order)
+    {
+        const CompositeSurface& surface = surfaces[s];
+        Geometry geometry(surface.source, screen, surface.source_stride, this->screen_stride);
+        vector<int> offsets = inverse_offsets(surface.transform_matrix, geometry);
+        for (int i = 0; i < screen_size; i++)
+        {
+            if (owner[i] < 0 && offsets[i] >= 0)
+            {
+                owner[i] = s;
+                lookup_table[i] = static_cast<uint32_t>(offsets[i]);
+                surface_pixels[s]++;
+            }
+        }
+    }
+
+    /* runs of one owner within a tile row, grouped by screen tile; the padding past each row is left alone */
+    int tiles_x = (screen.width + tile_size.width - 1) / tile_size.width;
+    int tiles_y = (screen.height + tile_size.height - 1) / tile_size.height;
+    tile_begin.reserve(tiles_x * tiles_y + 1);
+
+    for (int ty = 0; ty < tiles_y; ty++)
+    {
+        for (int tx = 0; tx < tiles_x; tx++)
+        {
+            tile_begin.push_back(static_cast<int>(runs.size()));
+            int x_begin = tx * tile_size.width;
+            int x_end = min(x_begin + tile_size.width, screen.width);
+            for (int y = ty * tile_size.height; y < min((ty + 1) * tile_size.height, screen.height); y++)
+            {
+                int row = y * this->screen_stride;
+                for (int x = x_begin; x < x_end; x++)
+                {
+                    if (x > x_begin && owner[row + x] == runs.back().surface)
+                        runs.back().length++;
+                    else
+                        runs.push_back({ static_cast<uint32_t>(row + x), 1, owner[row + x] });
+                }
+            }
+        }
+    }
+    tile_begin.push_back(static_cast<int>(runs.size()));
+}
+
+void Compositor::apply(const vector<const uint*>& sources, uint* screen) const
+{
+    CV_Assert(sources.size() == surface_pixels.size());
+    const uint32_t* lut = lookup_table.get();
+
+    run_parallel(pool.get(), profiler.get(), Range(0, static_cast<int>(tile_begin.size()) - 1), [&](const Range& tiles){
+        for (int r = tile_begin[tiles.start]; r < tile_begin[tiles.end]; r++)
+        {
+            const Run& run = runs[r];
+            uint* screen_partial = screen + run.dst_offset;
+            if (run.surface < 0)
+            {
+                fill_n(screen_partial, run.length, 0);
+                continue;
+            }
+
+            const uint32_t* lut_partial = lut + run.dst_offset;
+            const uint* image_data = sources[run.surface];
+            for (uint32_t k = 0; k < run.length; k++)
+            {
+                *screen_partial++ = image_data[*lut_partial++];
+            }
+        }
+    }, n_threads);
+}
+
+void Compositor::apply_surface(int surface, const uint* source, uint* screen) const
+{
+    const uint32_t* lut = lookup_table.get();
+
+    run_parallel(pool.get(), profiler.get(), Range(0, static_cast<int>(tile_begin.size()) - 1), [&](const Range& tiles){
+        for (int r = tile_begin[tiles.start]; r < tile_begin[tiles.end]; r++)
+        {
+            const Run& run = runs[r];
+            if (run.surface != surface)
+                continue;
+
+            const uint32_t* lut_partial = lut + run.dst_offset;
+            uint* screen_partial = screen + run.dst_offset;
+            for (uint32_t k = 0; k < run.length; k++)
+            {
+                *screen_partial++ = source[*lut_partial++];
+            }
+        }
+    }, n_threads);
+}
+
+string Compositor::summary() const
+{
+    int screen_pixels = screen.area();
+    int covered = 0;
+    string text;
+    char buffer[96];
+    for (size_t s = 0; s < surface_pixels.size(); s++)
+    {
+        covered += surface_pixels[s];
+        snprintf(buffer, sizeof(buffer), "surface %zu : %.1f%% of screen on top\n", s, 100. * surface_pixels[s] / screen_pixels);
+        text += buffer;
+    }
+    snprintf(buffer, sizeof(buffer), "%zu surfaces, %zu screen tiles, %zu runs, %.1f%% of screen covered",
+             surface_pixels.size(), tile_begin.size() - 1, runs.size(), 100. * covered / screen_pixels);
+    return text + buffer;
+}
+
+
+}
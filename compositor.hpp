@@ -0,0 +1,75 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "common.hpp"
+
+using namespace std;
+using namespace cv;
+
+
+namespace ins
+{
+
+
+/* One content surface of a Compositor: its frames are warped onto the shared screen by the homography
+ */
+struct CompositeSurface
+{
+    Mat transform_matrix;   // source to screen, as from get_transform_matrix()
+    Size source;
+    int source_stride;      // in pixels; 0 for a packed source
+    int z;                  // surfaces with a higher z cover the ones below
+
+    CompositeSurface(Mat transform_matrix, Size source, int z, int source_stride = 0);
+};
+
+
+/* Warps several surfaces into one screen in a single gather pass.
+ * Every screen pixel is resolved to the topmost surface covering it when the table is built, and the table is
+ * split into screen tiles of (surface, run) entries, so each tile is written exactly once by one thread
+ * instead of every surface making its own full-screen pass. Pixels no surface covers are cleared to zero.
+ */
+class Compositor
+{
+public:
+    Compositor(const vector<CompositeSurface>& surfaces, Size screen, int screen_stride = 0, Size tile_size = Size(64, 64));
+
+    /* sources[i] is the current frame of surfaces[i] */
+    void apply(const vector<const uint*>& sources, uint* screen) const;
+
+    /* writes only the pixels where the surface is on top; for timing a surface's share of apply() */
+    void apply_surface(int surface, const uint* source, uint* screen) const;
+
+    /* the same parallel backend hooks as LUT; nullptr goes back to OpenCV's parallel backend */
+    void set_thread_pool(shared_ptr<ThreadPool> pool) { this->pool = pool; }
+    /* nullptr stops profiling */
+    void set_profiler(shared_ptr<LUTProfiler> profiler) { this->profiler = profiler; }
+
+    int surface_count() const { return static_cast<int>(surface_pixels.size()); }
+    int visible_pixels(int surface) const { return surface_pixels[surface]; }
+    string summary() const;
+
+private:
+    struct Run
+    {
+        uint32_t dst_offset;
+        uint32_t length;
+        int surface;        // -1 for pixels no surface covers
+    };
+    Size screen;
+    int screen_stride;
+    unique_ptr<uint32_t[]> lookup_table;    // source offset of every screen pixel within its surface
+    vector<Run> runs;
+    vector<int> tile_begin;                 // runs of screen tile t are runs[tile_begin[t]] .. runs[tile_begin[t + 1] - 1]
+    vector<int> surface_pixels;
+    int n_threads;
+    shared_ptr<ThreadPool> pool;
+    shared_ptr<LUTProfiler> profiler;
+};
+
+
+}
@@ -0,0 +1,197 @@
+#include <cstdio>
+#include <cstring>
+
+#include "dirty_tiles.hpp"
+#include "thread_pool.hpp"
+
+
+namespace ins
+{
+
+
+DirtyTileLUT::DirtyTileLUT(const Warp& warp, const Geometry& geometry, uint* datastart, Size tile_size)
+    : ParallelReverseLUT(warp, geometry, datastart), geometry(geometry), tile_size(tile_size)
+{
+    CV_Assert(tile_size.width > 0 && tile_size.height > 0);
+
+    tiles_x = (geometry.source.width + tile_size.width - 1) / tile_size.width;
+    tiles_y = (geometry.source.height + tile_size.height - 1) / tile_size.height;
+    int n_tiles = tiles_x * tiles_y;
+    int stride = geometry.source_stride;
+
+    auto tile_of = [&](uint32_t offset) {
+        return static_cast<int>(offset / stride / tile_size.height) * tiles_x + static_cast<int>(offset % stride) / tile_size.width;
+    };
+
+    /* runs of consecutive screen pixels sampling the same source tile, in screen order */
+    const uint32_t* lut = lookup_table.get();
+    vector<Run> found;
+    vector<int> found_tile;
+    for (int i = 0; i < table_size; i++)
+    {
+        if (lut[i] == NO_SOURCE)
+            continue;
+
+        int tile = tile_of(lut[i]);
+        if (!found.empty() && found_tile.back() == tile && static_cast<int>(found.back().dst_offset + found.back().length) == i)
+            found.back().length++;
+        else
+        {
+            found.push_back({ static_cast<uint32_t>(i), 1 });
+            found_tile.push_back(tile);
+        }
+    }
+
+    /* counting sort by source tile; each tile keeps its runs in screen order */
+    tile_begin.assign(n_tiles + 1, 0);
+    tile_pixels.assign(n_tiles, 0);
+    for (size_t r = 0; r < found.size(); r++)
+    {
+        tile_begin[found_tile[r] + 1]++;
+        tile_pixels[found_tile[r]] += found[r].length;
+    }
+    for (int t = 0; t < n_tiles; t++)
+    {
+        tile_begin[t + 1] += tile_begin[t];
+    }
+
+    runs.resize(found.size());
+    vector<int> cursor(tile_begin.begin(), tile_begin.end() - 1);
+    for (size_t r = 0; r < found.size(); r++)
+    {
+        runs[cursor[found_tile[r]]++] = found[r];
+    }
+
+    marked.assign(n_tiles, 0);
+    dirty_tiles.reserve(n_tiles);
+}
+
+int DirtyTileLUT::apply_dirty(const uint* image_data, uint* screen, const vector<Rect>& dirty)
+{
+    dirty_tiles.clear();
+    int written = 0;
+
+    Rect bounds(Point(0, 0), geometry.source);
+    for (Rect rect : dirty)
+    {
+        rect &= bounds;
+        if (rect.empty())
+            continue;
+
+        for (int ty = rect.y / tile_size.height; ty <= (rect.y + rect.height - 1) / tile_size.height; ty++)
+        {
+            for (int tx = rect.x / tile_size.width; tx <= (rect.x + rect.width - 1) / tile_size.width; tx++)
+            {
+                int tile = ty * tiles_x + tx;
+                if (marked[tile])
+                    continue;
+                marked[tile] = 1;
+                dirty_tiles.push_back(tile);
+                written += tile_pixels[tile];
+            }
+        }
+    }
+
+    /* different source tiles feed disjoint screen pixels, so the tiles can be split between threads freely */
+    const uint32_t* lut = lookup_table.get();
+    run_parallel(Range(0, static_cast<int>(dirty_tiles.size())), [&](const Range& range){
+        for (int i = range.start; i < range.end; i++)
+        {
+            int tile = dirty_tiles[i];
+            for (int r = tile_begin[tile]; r < tile_begin[tile + 1]; r++)
+            {
+                const uint32_t* lut_partial = lut + runs[r].dst_offset;
+                uint* screen_partial = screen + runs[r].dst_offset;
+                for (uint32_t k = 0; k < runs[r].length; k++)
+                {
+                    *screen_partial++ = image_data[*lut_partial++];
+                }
+            }
+        }
+    }, n_threads);
+
+    /* only the marked tiles are cleared, so the cost stays proportional to the dirty area */
+    for (int tile : dirty_tiles)
+        marked[tile] = 0;
+    return written;
+}
+
+string DirtyTileLUT::summary() const
+{
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "%d source tiles of %dx%d, %zu screen runs, %.1f runs per tile",
+             tiles_x * tiles_y, tile_size.width, tile_size.height, runs.size(),
+             static_cast<double>(runs.size()) / (tiles_x * tiles_y));
+    return buffer;
+}
+
+
+TileDiffer::TileDiffer(Size source, int source_stride, Size tile_size)
+    : source(source), source_stride(source_stride), tile_size(tile_size)
+{
+    CV_Assert(source_stride >= source.width && tile_size.width > 0 && tile_size.height > 0);
+    previous.resize(static_cast<size_t>(source_stride) * source.height);
+    tiles_x = (source.width + tile_size.width - 1) / tile_size.width;
+    tiles_y = (source.height + tile_size.height - 1) / tile_size.height;
+    tile_rows.resize(tiles_y);
+}
+
+const vector<Rect>& TileDiffer::diff(const uint* frame)
+{
+    dirty.clear();
+    if (!has_previous)
+    {
+        memcpy(previous.data(), frame, previous.size() * sizeof(uint));
+        has_previous = true;
+        dirty.push_back(Rect(Point(0, 0), source));
+        return dirty;
+    }
+
+    run_parallel(pool.get(), profiler.get(), Range(0, tiles_y), [&](const Range& range){
+        for (int ty = range.start; ty < range.end; ty++)
+        {
+            tile_rows[ty].clear();
+            int y_begin = ty * tile_size.height;
+            int y_end = min(y_begin + tile_size.height, source.height);
+            int dirty_begin = -1;
+
+            for (int tx = 0; tx < tiles_x; tx++)
+            {
+                int x = tx * tile_size.width;
+                size_t bytes = min(tile_size.width, source.width - x) * sizeof(uint);
+
+                /* rows above the first difference are equal already, so only the rest is copied */
+                bool changed = false;
+                for (int y = y_begin; y < y_end; y++)
+                {
+                    const uint* current = frame + y * source_stride + x;
+                    uint* kept = previous.data() + y * source_stride + x;
+                    if (changed || memcmp(current, kept, bytes) != 0)
+                    {
+                        memcpy(kept, current, bytes);
+                        changed = true;
+                    }
+                }
+
+                if (changed && dirty_begin < 0)
+                    dirty_begin = x;
+                else if (!changed && dirty_begin >= 0)
+                {
+                    tile_rows[ty].push_back(Rect(dirty_begin, y_begin, x - dirty_begin, y_end - y_begin));
+                    dirty_begin = -1;
+                }
+            }
+            if (dirty_begin >= 0)
+                tile_rows[ty].push_back(Rect(dirty_begin, y_begin, source.width - dirty_begin, y_end - y_begin));
+        }
+    }, pool ? pool->size() : getNumThreads());
+
+    for (const vector<Rect>& row : tile_rows)
+    {
+        dirty.insert(dirty.end(), row.begin(), row.end());
+    }
+    return dirty;
+}
+
+
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "common.hpp"
+
+using namespace std;
+using namespace cv;
+
+
+namespace ins
+{
+
+
+/* Gather table with a per-source-tile index of the screen runs that sample each tile,
+ * so a frame whose changes are confined to a few source rectangles only re-warps the screen pixels they feed.
+ * apply() still warps the whole frame; apply_dirty() expects the screen to hold the warp of the previous frame.
+ */
+class DirtyTileLUT : public ParallelReverseLUT
+{
+private:
+    struct Run
+    {
+        uint32_t dst_offset;
+        uint32_t length;
+    };
+    Geometry geometry;
+    Size tile_size;
+    int tiles_x;
+    int tiles_y;
+    vector<Run> runs;
+    vector<int> tile_begin;     // runs of source tile t are runs[tile_begin[t]] .. runs[tile_begin[t + 1] - 1]
+    vector<int> tile_pixels;    // screen pixels sampling source tile t
+    vector<char> marked;        // apply_dirty scratch, kept so a frame allocates nothing; all zero between calls
+    vector<int> dirty_tiles;
+
+public:
+    DirtyTileLUT(const Warp& warp, const Geometry& geometry, uint* datastart, Size tile_size);
+    using ParallelReverseLUT::apply;
+
+    /* re-warps the screen pixels sampling any source tile that overlaps a dirty rectangle;
+     * returns the number of screen pixels written
+     */
+    int apply_dirty(const uint* image_data, uint* screen, const vector<Rect>& dirty);
+    int apply_dirty(const uint* image_data, const vector<Rect>& dirty) { return apply_dirty(image_data, datastart, dirty); }
+
+    Size tile() const { return tile_size; }
+    string summary() const override;
+};
+
+
+/* Finds the source tiles that changed since the previous frame by comparing each tile against a private copy;
+ * the first frame is entirely dirty. Dirty tiles next to each other in a tile row are merged into one rectangle.
+ * Tile rows are compared in parallel on the same backend as the LUTs, with the pool's threads when one is set.
+ */
+class TileDiffer
+{
+public:
+    TileDiffer(Size source, int source_stride, Size tile_size);
+    /* the rectangles stay valid until the next call; they are kept in the differ so a frame allocates nothing */
+    const vector<Rect>& diff(const uint* frame);
+    void reset() { has_previous = false; }
+
+    /* nullptr goes back to OpenCV's parallel backend */
+    void set_thread_pool(shared_ptr<ThreadPool> pool) { this->pool = pool; }
+    /* nullptr stops profiling */
+    void set_profiler(shared_ptr<LUTProfiler> profiler) { this->profiler = profiler; }
+
+private:
+    Size source;
+    int source_stride;
+    Size tile_size;
+    int tiles_x;
+    int tiles_y;
+    vector<uint> previous;
+    vector<vector<Rect>> tile_rows;
+    vector<Rect> dirty;
+    bool has_previous = false;
+    shared_ptr<ThreadPool> pool;
+    shared_ptr<LUTProfiler> profiler;
+};
+
+
+}
@@ -0,0 +1,314 @@
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "frame_input.hpp"
+
+
+namespace ins
+{
+
+
+RawFrameFile::RawFrameFile(const string& path, Size size)
+    : path(path), frame_size(size), n_frames(0), next(0), mapping(nullptr), mapping_size(0)
+{
+    CV_Assert(size.width > 0 && size.height > 0);
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        CV_Error(Error::StsError, "cannot open " + path + " : " + strerror(errno));
+
+    struct stat file_stat;
+    size_t frame_bytes = static_cast<size_t>(size.area()) * sizeof(uint);
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0 || static_cast<size_t>(file_stat.st_size) % frame_bytes != 0)
+    {
+        close(fd);
+        CV_Error(Error::StsBadSize, path + " does not hold whole BGRA frames of " + to_string(size.width) + "x" + to_string(size.height));
+    }
+
+    mapping_size = file_stat.st_size;
+    n_frames = static_cast<int>(mapping_size / frame_bytes);
+    void* mapped = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        CV_Error(Error::StsError, "cannot map " + path + " : " + strerror(errno));
+    mapping = static_cast<uchar*>(mapped);
+}
+
+RawFrameFile::~RawFrameFile()
+{
+    munmap(mapping, mapping_size);
+}
+
+const uint* RawFrameFile::acquire(chrono::milliseconds /* timeout: the frames never have to be waited for */)
+{
+    const uchar* frame = mapping + static_cast<size_t>(next) * frame_size.area() * sizeof(uint);
+    next = (next + 1) % n_frames;
+    return reinterpret_cast<const uint*>(frame);
+}
+
+string RawFrameFile::summary() const
+{
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "raw frames %s : %d frames of %dx%d, mapped", path.c_str(), n_frames, frame_size.width, frame_size.height);
+    return buffer;
+}
+
+
+static const char RING_MAGIC[8] = { 'I', 'N', 'S', 'R', 'I', 'N', 'G', '\0' };
+static const uint32_t RING_VERSION = 1;
+
+static_assert(atomic<uint64_t>::is_always_lock_free && atomic<uint32_t>::is_always_lock_free,
+              "the ring counters are shared between processes and must not need a lock");
+
+struct SharedFrameRing::Header
+{
+    char magic[8];
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t stride;
+    int32_t capacity;
+    uint64_t slot_bytes;
+    uint64_t data_offset;
+    alignas(64) atomic<uint64_t> write;         // frames published by the producer
+    alignas(64) atomic<uint64_t> release;       // frames given back by the consumer
+    alignas(64) atomic<uint32_t> consumers;
+
+    /* the slot records follow the header */
+    Slot* slots() { return reinterpret_cast<Slot*>(this + 1); }
+};
+
+static size_t page_align(size_t bytes)
+{
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return (bytes + page - 1) / page * page;
+}
+
+static string shm_name(const string& name)
+{
+    return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+
+
+SharedFrameRing::SharedFrameRing(const string& name, bool owner, void* mapping, size_t mapping_size)
+    : name(name), owner(owner), header(static_cast<Header*>(mapping)), mapping_size(mapping_size),
+      taken(0), holding(false), n_taken(0), n_skipped(0)
+{
+}
+
+unique_ptr<SharedFrameRing> SharedFrameRing::create(const string& name, Size size, int capacity)
+{
+    CV_Assert(size.width > 0 && size.height > 0 && capacity >= 2);
+
+    string path = shm_name(name);
+    shm_unlink(path.c_str());
+    int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+        CV_Error(Error::StsError, "cannot create shared memory " + path + " : " + strerror(errno));
+
+    size_t slot_bytes = page_align(static_cast<size_t>(size.area()) * sizeof(uint));
+    size_t data_offset = page_align(sizeof(Header) + capacity * sizeof(Slot));
+    size_t mapping_size = data_offset + slot_bytes * capacity;
+    void* mapping = MAP_FAILED;
+    if (ftruncate(fd, mapping_size) == 0)
+        mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        shm_unlink(path.c_str());
+        CV_Error(Error::StsError, "cannot map shared memory " + path + " : " + strerror(errno));
+    }
+
+    Header* header = new (mapping) Header();
+    header->version = RING_VERSION;
+    header->width = size.width;
+    header->height = size.height;
+    header->stride = size.width;
+    header->capacity = capacity;
+    header->slot_bytes = slot_bytes;
+    header->data_offset = data_offset;
+    header->write.store(0, memory_order_relaxed);
+    header->release.store(0, memory_order_relaxed);
+    header->consumers.store(0, memory_order_relaxed);
+    memset(header->slots(), 0, capacity * sizeof(Slot));
+
+    /* the magic goes in last, so a consumer that opens the ring early does not take it for a finished one */
+    atomic_thread_fence(memory_order_release);
+    memcpy(header->magic, RING_MAGIC, sizeof(RING_MAGIC));
+
+    return unique_ptr<SharedFrameRing>(new SharedFrameRing(path, true, mapping, mapping_size));
+}
+
+unique_ptr<SharedFrameRing> SharedFrameRing::open(const string& name)
+{
+    string path = shm_name(name);
+    int fd = shm_open(path.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        CV_Error(Error::StsError, "cannot open shared memory " + path + " : " + strerror(errno));
+
+    struct stat file_stat;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &file_stat) == 0 && static_cast<size_t>(file_stat.st_size) >= sizeof(Header))
+        mapping = mmap(nullptr, file_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        CV_Error(Error::StsError, "cannot map shared memory " + path);
+
+    size_t mapping_size = file_stat.st_size;
+    Header* header = static_cast<Header*>(mapping);
+    if (memcmp(header->magic, RING_MAGIC, sizeof(RING_MAGIC)) != 0 ||
+        header->version != RING_VERSION ||
+        mapping_size != header->data_offset + header->slot_bytes * header->capacity)
+    {
+        munmap(mapping, mapping_size);
+        CV_Error(Error::StsBadArg, path + " is not a frame ring of this version");
+    }
+
+    header->consumers.fetch_add(1, memory_order_acq_rel);
+    return unique_ptr<SharedFrameRing>(new SharedFrameRing(path, false, mapping, mapping_size));
+}
+
+SharedFrameRing::~SharedFrameRing()
+{
+    if (owner)
+        shm_unlink(name.c_str());
+    else
+        header->consumers.fetch_sub(1, memory_order_acq_rel);
+    munmap(header, mapping_size);
+}
+
+Size SharedFrameRing::size() const
+{
+    return Size(header->width, header->height);
+}
+
+int SharedFrameRing::stride() const
+{
+    return header->stride;
+}
+
+int SharedFrameRing::capacity() const
+{
+    return header->capacity;
+}
+
+uint64_t SharedFrameRing::written() const
+{
+    return header->write.load(memory_order_acquire);
+}
+
+uint64_t SharedFrameRing::released() const
+{
+    return header->release.load(memory_order_acquire);
+}
+
+const SharedFrameRing::Slot& SharedFrameRing::slot(uint64_t sequence) const
+{
+    return header->slots()[sequence % header->capacity];
+}
+
+uint* SharedFrameRing::slot_data(uint64_t sequence) const
+{
+    return reinterpret_cast<uint*>(reinterpret_cast<uchar*>(header) + header->data_offset + (sequence % header->capacity) * header->slot_bytes);
+}
+
+int64_t SharedFrameRing::now_ns()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+const uint* SharedFrameRing::acquire(chrono::milliseconds timeout)
+{
+    CV_Assert(!owner && !holding);
+
+    auto deadline = chrono::steady_clock::now() + timeout;
+    while (true)
+    {
+        uint64_t write = header->write.load(memory_order_acquire);
+        uint64_t release = header->release.load(memory_order_relaxed);
+        if (write > release)
+        {
+            /* only the newest frame is shown; the older ones are given back at once */
+            for (uint64_t sequence = release; sequence + 1 < write; sequence++)
+            {
+                header->slots()[sequence % header->capacity].presented_ns = 0;
+                n_skipped++;
+            }
+            header->release.store(write - 1, memory_order_release);
+
+            taken = write - 1;
+            holding = true;
+            n_taken++;
+            return slot_data(taken);
+        }
+        if (chrono::steady_clock::now() >= deadline)
+            return nullptr;
+        this_thread::yield();
+    }
+}
+
+void SharedFrameRing::release()
+{
+    CV_Assert(holding);
+    header->slots()[taken % header->capacity].presented_ns = now_ns();
+    header->release.store(taken + 1, memory_order_release);
+    holding = false;
+}
+
+uint* SharedFrameRing::begin_write()
+{
+    CV_Assert(owner);
+
+    uint64_t write = header->write.load(memory_order_relaxed);
+    if (write - header->release.load(memory_order_acquire) >= static_cast<uint64_t>(header->capacity))
+        return nullptr;
+
+    Slot& record = header->slots()[write % header->capacity];
+    record.sequence = write;
+    record.presented_ns = -1;
+    return slot_data(write);
+}
+
+void SharedFrameRing::end_write()
+{
+    uint64_t write = header->write.load(memory_order_relaxed);
+    header->slots()[write % header->capacity].captured_ns = now_ns();
+    header->write.store(write + 1, memory_order_release);
+}
+
+bool SharedFrameRing::wait_for_consumer(chrono::milliseconds timeout) const
+{
+    auto deadline = chrono::steady_clock::now() + timeout;
+    while (header->consumers.load(memory_order_acquire) == 0)
+    {
+        if (chrono::steady_clock::now() >= deadline)
+            return false;
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    return true;
+}
+
+string SharedFrameRing::summary() const
+{
+    char buffer[256];
+    if (owner)
+        snprintf(buffer, sizeof(buffer), "shared ring %s : %dx%d, %d slots, %llu frames written",
+                 name.c_str(), header->width, header->height, header->capacity, static_cast<unsigned long long>(written()));
+    else
+        snprintf(buffer, sizeof(buffer), "shared ring %s : %dx%d, %d slots, %llu frames shown, %llu skipped as stale",
+                 name.c_str(), header->width, header->height, header->capacity,
+                 static_cast<unsigned long long>(n_taken), static_cast<unsigned long long>(n_skipped));
+    return buffer;
+}
+
+
+}
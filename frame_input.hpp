@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <opencv2/core.hpp>
+
+using namespace std;
+using namespace cv;
+
+
+namespace ins
+{
+
+
+/* A source of BGRA frames that lives in mapped memory, so the LUTs read each frame where it was delivered.
+ * acquire() returns the next frame, or nullptr when none arrived within the timeout; the frame stays valid and
+ * unchanged until release(). No frame is copied and nothing is allocated per frame.
+ */
+class FrameInput
+{
+public:
+    virtual ~FrameInput() {}
+
+    virtual Size size() const = 0;
+    virtual int stride() const = 0;     // in pixels
+    virtual const uint* acquire(chrono::milliseconds timeout) = 0;
+    virtual void release() = 0;
+    virtual string summary() const = 0;
+};
+
+
+/* Headerless BGRA frames of one size back to back in a file, mapped read-only and played in a loop.
+ * Every frame is there already, so acquire() never blocks, ignores the timeout and never returns nullptr.
+ */
+class RawFrameFile : public FrameInput
+{
+public:
+    /* throws cv::Exception when the file cannot be mapped or does not hold a whole number of frames */
+    RawFrameFile(const string& path, Size size);
+    ~RawFrameFile();
+    RawFrameFile(const RawFrameFile&) = delete;
+    RawFrameFile& operator=(const RawFrameFile&) = delete;
+
+    Size size() const override { return frame_size; }
+    int stride() const override { return frame_size.width; }
+    const uint* acquire(chrono::milliseconds) override;
+    void release() override {}
+    string summary() const override;
+
+    int frames() const { return n_frames; }
+
+private:
+    string path;
+    Size frame_size;
+    int n_frames;
+    int next;
+    uchar* mapping;
+    size_t mapping_size;
+};
+
+
+/* A single-producer, single-consumer ring of BGRA frames in POSIX shared memory, for a producer in another process.
+ *
+ * Layout: a header page (magic, version, geometry, the write and release counters and one record per slot)
+ * followed by the slots, each starting on a page. The producer fills the slot at the write counter and publishes
+ * it by bumping the counter; the consumer takes the newest published frame, releases the stale ones unshown,
+ * and releases the frame it took once it is presented, stamping the time. Both counters only grow, so the ring
+ * is full when they are [capacity] apart. Timestamps are CLOCK_MONOTONIC nanoseconds, which all processes share.
+ */
+class SharedFrameRing : public FrameInput
+{
+public:
+    struct Slot
+    {
+        uint64_t sequence;
+        int64_t captured_ns;        // stamped by the producer when it publishes the slot
+        int64_t presented_ns;       // stamped by the consumer on release; 0 for a frame skipped as stale
+    };
+
+    /* producer side: creates (or replaces) the named segment; throws cv::Exception on failure */
+    static unique_ptr<SharedFrameRing> create(const string& name, Size size, int capacity);
+    /* consumer side: maps an existing segment; throws cv::Exception when it does not exist or does not match */
+    static unique_ptr<SharedFrameRing> open(const string& name);
+    ~SharedFrameRing();
+    SharedFrameRing(const SharedFrameRing&) = delete;
+    SharedFrameRing& operator=(const SharedFrameRing&) = delete;
+
+    Size size() const override;
+    int stride() const override;
+    const uint* acquire(chrono::milliseconds timeout) override;
+    void release() override;
+    string summary() const override;
+
+    /* producer: the slot to fill next, or nullptr while the ring is full; end_write() publishes it */
+    uint* begin_write();
+    void end_write();
+    /* producer: waits until a consumer has opened the ring */
+    bool wait_for_consumer(chrono::milliseconds timeout) const;
+
+    int capacity() const;
+    uint64_t written() const;
+    uint64_t released() const;
+    const Slot& slot(uint64_t sequence) const;
+
+    static int64_t now_ns();
+
+private:
+    struct Header;
+
+    string name;
+    bool owner;
+    Header* header;
+    size_t mapping_size;
+    uint64_t taken;         // consumer: sequence of the acquired frame
+    bool holding;
+    uint64_t n_taken, n_skipped;
+
+    SharedFrameRing(const string& name, bool owner, void* mapping, size_t mapping_size);
+    uint* slot_data(uint64_t sequence) const;
+};
+
+
+}
@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <regex>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "frame_input.hpp"
+
+using namespace std;
+using namespace cv;
+
+
+/* Deterministic gradient with an inverted band that moves 8 pixels per frame, so consecutive frames differ
+ */
+static void paint_frame(const vector<uint>& base, Size size, int index, uint* frame)
+{
+    memcpy(frame, base.data(), base.size() * sizeof(uint));
+    int band_x = index * 8 % max(1, size.width - 32);
+    for (int y = 0; y < size.height; y++)
+    {
+        uint* row = frame + y * size.width + band_x;
+        for (int x = 0; x < min(32, size.width); x++)
+            row[x] = ~row[x];
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    const string keys =
+        "{h help     |           | print this message and exit. }"
+        "{@ring      |/ins-frames| name of the shared-memory ring to create. }"
+        "{size       |1920x1080  | the size of the frames. format: WxH }"
+        "{slots      |4          | frames the ring holds. }"
+        "{fps        |60         | frames per second to publish; 0 publishes as fast as the ring takes them. }"
+        "{frames     |600        | the number of frames to produce. }"
+        "{wait       |10         | seconds to wait for a consumer before giving up. }"
+        "{dump       |           | write [frames] frames to this raw file for app.out [input]=raw:... instead of running a ring. }";
+
+    CommandLineParser parser(argc, argv, keys);
+    parser.about(
+        "Publish BGRA frames into a shared-memory ring read by app.out [input]=shm:<ring>, and measure the latency\n"
+        "from publishing each frame to the consumer releasing it after the warp.\n"
+    );
+    if (parser.has("help"))
+    {
+        parser.printMessage();
+        return EXIT_SUCCESS;
+    }
+
+    smatch matches;
+    string tmps = parser.get<string>("size");
+    if (!regex_match(tmps, matches, regex(R"~((\d+)[x|X](\d+))~")) || stoi(matches[1].str()) <= 0 || stoi(matches[2].str()) <= 0)
+    {
+        printf("Error: failed to parse [size]=%s\n", tmps.c_str());
+        return EXIT_FAILURE;
+    }
+    Size size(stoi(matches[1].str()), stoi(matches[2].str()));
+    string ring_name = parser.get<string>("@ring");
+    int slots = parser.get<int>("slots");
+    double fps = parser.get<double>("fps");
+    int n_frames = parser.get<int>("frames");
+    int wait_s = parser.get<int>("wait");
+    string dump_path = parser.get<string>("dump");
+    if (!parser.check())
+    {
+        parser.printErrors();
+        return EXIT_FAILURE;
+    }
+    if (slots < 2 || fps < 0 || n_frames < 1)
+    {
+        printf("Error: [slots] must be at least 2, [fps] must not be negative and [frames] must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    vector<uint> base(size.area());
+    for (size_t i = 0; i < base.size(); i++)
+        base[i] = static_cast<uint>(i) * 2654435761u | 0xff000000u;
+
+    if (!dump_path.empty())
+    {
+        ofstream dump(dump_path, ios::binary);
+        vector<uint> frame(base.size());
+        for (int i = 0; i < n_frames && dump; i++)
+        {
+            paint_frame(base, size, i, frame.data());
+            dump.write(reinterpret_cast<const char*>(frame.data()), frame.size() * sizeof(uint));
+        }
+        if (!dump)
+        {
+            printf("Failed to write %s\n", dump_path.c_str());
+            return EXIT_FAILURE;
+        }
+        printf("Wrote %d frames of %dx%d to %s\n", n_frames, size.width, size.height, dump_path.c_str());
+        return EXIT_SUCCESS;
+    }
+
+    unique_ptr<ins::SharedFrameRing> ring;
+    try
+    {
+        ring = ins::SharedFrameRing::create(ring_name, size, slots);
+    }
+    catch (const cv::Exception& e)
+    {
+        printf("Failed to create the ring! : %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    printf("Waiting for a consumer on %s ...\n", ring_name.c_str());
+    if (!ring->wait_for_consumer(chrono::seconds(wait_s)))
+    {
+        printf("No consumer opened the ring within %d s\n", wait_s);
+        return EXIT_FAILURE;
+    }
+
+    /* a slot's record is read back before the slot is written again, i.e. as soon as the consumer releases it */
+    vector<double> latency_us;
+    uint64_t collected = 0, skipped = 0;
+    auto collect = [&]{
+        for (uint64_t released = ring->released(); collected < released; collected++)
+        {
+            const ins::SharedFrameRing::Slot& slot = ring->slot(collected);
+            if (slot.presented_ns > 0)
+                latency_us.push_back((slot.presented_ns - slot.captured_ns) / 1e3);
+            else
+                skipped++;
+        }
+    };
+
+    int dropped = 0;
+    auto period = fps > 0 ? chrono::duration<double>(1 / fps) : chrono::duration<double>(0);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < n_frames; i++)
+    {
+        if (fps > 0)
+            this_thread::sleep_until(start + chrono::duration_cast<chrono::steady_clock::duration>(period * i));
+
+        collect();
+        uint* slot = ring->begin_write();
+        while (!slot && fps == 0)
+        {
+            this_thread::yield();
+            collect();
+            slot = ring->begin_write();
+        }
+        if (!slot)
+        {
+            /* a camera does not wait for a slow consumer either */
+            dropped++;
+            continue;
+        }
+        paint_frame(base, size, i, slot);
+        ring->end_write();
+    }
+
+    auto drain_deadline = chrono::steady_clock::now() + chrono::seconds(1);
+    while (ring->released() < ring->written() && chrono::steady_clock::now() < drain_deadline)
+        this_thread::sleep_for(chrono::milliseconds(1));
+    collect();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    printf("%s\n", ring->summary().c_str());
+    printf("Frames : %d produced, %d dropped while the ring was full, %llu skipped by the consumer as stale, %zu shown, %.1f fps shown\n",
+           n_frames, dropped, static_cast<unsigned long long>(skipped), latency_us.size(), latency_us.size() / seconds);
+    if (!latency_us.empty())
+    {
+        sort(latency_us.begin(), latency_us.end());
+        double sum = 0;
+        for (double t : latency_us)
+            sum += t;
+        printf("Publish to release latency : mean %.1f us, median %.1f us, p99 %.1f us, max %.1f us\n",
+               sum / latency_us.size(), latency_us[latency_us.size() / 2],
+               latency_us[min(latency_us.size() - 1, static_cast<size_t>(latency_us.size() * 0.99))], latency_us.back());
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,195 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fb.h>
+#endif
+
+#include "framebuffer.hpp"
+
+
+namespace ins
+{
+
+
+static int bytes_per_pixel_of(PixelFormat format)
+{
+    switch (format)
+    {
+    case PixelFormat::BGRA32: return 4;
+    case PixelFormat::BGR24: return 3;
+    case PixelFormat::RGB565: return 2;
+    case PixelFormat::GRAY8: return 1;
+    default: return 0;
+    }
+}
+
+
+#ifdef __linux__
+static bool has_channels(const fb_var_screeninfo& var, int red, int green, int blue)
+{
+    return static_cast<int>(var.red.offset) == red && static_cast<int>(var.green.offset) == green &&
+           static_cast<int>(var.blue.offset) == blue;
+}
+#endif
+
+
+FramebufferOutput::FramebufferOutput(const string& path, Size size, PixelFormat format, int pages, bool stand_in)
+    : path(path), fd(-1), device(false), screen(size), pixel_format(format), bytes_per_pixel(0), line_length(0),
+      n_pages(max(1, pages)), back(0), mapping(nullptr), mapping_size(0)
+{
+    bool created = false;
+    auto fail = [&](const string& reason) {
+        if (fd >= 0)
+            close(fd);
+        if (created)
+            unlink(path.c_str());
+        CV_Error(Error::StsError, path + ": " + reason);
+    };
+
+    /* a missing path is only created as a stand-in, and under /dev only when stand_in says so; whatever is created
+     * here is marked, so a later failure removes it again
+     */
+    fd = ::open(path.c_str(), O_RDWR);
+    if (fd < 0 && errno == ENOENT && (stand_in || path.compare(0, 5, "/dev/") != 0))
+    {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        created = fd >= 0;
+    }
+    if (fd < 0)
+        fail(strerror(errno));
+
+    struct stat status;
+    if (fstat(fd, &status) != 0)
+        fail(strerror(errno));
+    device = S_ISCHR(status.st_mode);
+    if (!device && !S_ISREG(status.st_mode))
+        fail("neither a framebuffer device nor a regular file");
+    if (!device && !stand_in && !created)
+        fail("exists and is not a framebuffer device; set stand_in to use it as a stand-in");
+
+    if (device)
+    {
+#ifdef __linux__
+        fb_var_screeninfo var;
+        fb_fix_screeninfo fix;
+        if (ioctl(fd, FBIOGET_VSCREENINFO, &var) != 0 || ioctl(fd, FBIOGET_FSCREENINFO, &fix) != 0)
+            fail("not a framebuffer device");
+
+        /* the frames are BGR ordered, blue in the lowest bits; RGBA ordered devices would show red and blue swapped */
+        bool bgr_order = true;
+        switch (var.bits_per_pixel)
+        {
+        case 32: pixel_format = PixelFormat::BGRA32; bgr_order = has_channels(var, 16, 8, 0); break;
+        case 24: pixel_format = PixelFormat::BGR24; bgr_order = has_channels(var, 16, 8, 0); break;
+        case 16: pixel_format = PixelFormat::RGB565; bgr_order = has_channels(var, 11, 5, 0); break;
+        case 8: pixel_format = PixelFormat::GRAY8; break;
+        default: fail("unsupported depth of " + to_string(var.bits_per_pixel) + " bits per pixel");
+        }
+        if (!bgr_order)
+            fail("unsupported channel order at " + to_string(var.bits_per_pixel) + " bits per pixel: red at bit " +
+                 to_string(var.red.offset) + ", green at bit " + to_string(var.green.offset) + ", blue at bit " + to_string(var.blue.offset));
+
+        /* ask for a virtual height that holds every page; drivers that cannot pan keep a single page */
+        if (var.yres_virtual < var.yres * n_pages)
+        {
+            fb_var_screeninfo wanted = var;
+            wanted.yres_virtual = var.yres * n_pages;
+            if (ioctl(fd, FBIOPUT_VSCREENINFO, &wanted) == 0)
+            {
+                ioctl(fd, FBIOGET_VSCREENINFO, &var);
+                ioctl(fd, FBIOGET_FSCREENINFO, &fix);
+            }
+        }
+
+        screen = Size(var.xres, var.yres);
+        bytes_per_pixel = var.bits_per_pixel / 8;
+        line_length = fix.line_length;
+        mapping_size = fix.smem_len;
+        if (line_length % bytes_per_pixel != 0)
+            fail("the line length is not a whole number of pixels");
+        n_pages = max(1, min({ n_pages, static_cast<int>(var.yres_virtual / var.yres),
+                               static_cast<int>(fix.smem_len / (static_cast<size_t>(line_length) * var.yres)) }));
+
+        /* start from a known state: page 0 on screen */
+        var.xoffset = 0;
+        var.yoffset = 0;
+        ioctl(fd, FBIOPAN_DISPLAY, &var);
+#else
+        fail("framebuffer devices are only supported on Linux");
+#endif
+    }
+    else
+    {
+        bytes_per_pixel = bytes_per_pixel_of(format);
+        if (bytes_per_pixel == 0)
+            fail(string("cannot hold ") + pixel_format_name(format) + " frames");
+        line_length = size.width * bytes_per_pixel;
+        mapping_size = static_cast<size_t>(line_length) * size.height * n_pages;
+        if (ftruncate(fd, mapping_size) != 0)
+            fail(strerror(errno));
+    }
+
+    void* address = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED)
+        fail(strerror(errno));
+    mapping = static_cast<uchar*>(address);
+
+    /* the first frame goes to the page that is not on screen */
+    back = n_pages > 1 ? 1 : 0;
+}
+
+FramebufferOutput::~FramebufferOutput()
+{
+    munmap(mapping, mapping_size);
+    close(fd);
+}
+
+Mat FramebufferOutput::back_mat()
+{
+    int type = bytes_per_pixel == 4 ? CV_8UC4 : bytes_per_pixel == 3 ? CV_8UC3 : bytes_per_pixel == 2 ? CV_8UC2 : CV_8UC1;
+    return Mat(screen.height, screen.width, type, page(back), line_length);
+}
+
+void FramebufferOutput::flip(bool vsync)
+{
+#ifdef __linux__
+    if (device)
+    {
+        if (n_pages > 1)
+        {
+            fb_var_screeninfo var;
+            if (ioctl(fd, FBIOGET_VSCREENINFO, &var) == 0)
+            {
+                var.xoffset = 0;
+                var.yoffset = back * screen.height;
+                ioctl(fd, FBIOPAN_DISPLAY, &var);
+            }
+        }
+        /* drivers without FBIO_WAITFORVSYNC fail it immediately, which leaves the flip unsynchronized */
+        if (vsync)
+        {
+            int display = 0;
+            ioctl(fd, FBIO_WAITFORVSYNC, &display);
+        }
+    }
+#endif
+    back = (back + 1) % n_pages;
+}
+
+string FramebufferOutput::summary() const
+{
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "Output : %s (%s), %dx%d %s, stride %d px, %d page%s",
+             path.c_str(), device ? "framebuffer device" : "file stand-in",
+             screen.width, screen.height, pixel_format_name(pixel_format), stride(), n_pages, n_pages > 1 ? "s" : "");
+    return buffer;
+}
+
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <opencv2/core.hpp>
+
+#include "common.hpp"
+
+using namespace std;
+using namespace cv;
+
+
+namespace ins
+{
+
+
+/* A memory-mapped display the LUTs write into directly, so a warped frame is never copied on its way out.
+ *
+ * A Linux framebuffer device (/dev/fbN) gives its own size, stride and pixel format; with room for several
+ * pages in its virtual resolution, flip() pans the display to the page just drawn and the next page becomes
+ * the back buffer. Devices whose channels are not in BGR order are rejected.
+ *
+ * For testing without a display, a stand-in is a regular file of the requested size and format holding all pages
+ * back to back. A path outside /dev that does not exist yet is created as one; an existing file, or any file under
+ * /dev (e.g. in /dev/shm), is only created or resized when stand_in is set, so a mistyped device is never replaced.
+ */
+class FramebufferOutput
+{
+public:
+    /* throws cv::Exception when the path cannot be mapped or its pixel format is not supported */
+    FramebufferOutput(const string& path, Size size, PixelFormat format, int pages = 2, bool stand_in = false);
+    ~FramebufferOutput();
+    FramebufferOutput(const FramebufferOutput&) = delete;
+    FramebufferOutput& operator=(const FramebufferOutput&) = delete;
+
+    Size size() const { return screen; }
+    int stride() const { return line_length / bytes_per_pixel; }     // in pixels
+    PixelFormat format() const { return pixel_format; }
+    int pages() const { return n_pages; }
+    bool is_device() const { return device; }
+
+    uint* back_buffer() { return reinterpret_cast<uint*>(page(back)); }
+    Mat back_mat();     // header over the back buffer, with the display's stride
+
+    /* shows the back buffer and moves on to the next page; with vsync, also waits for the vertical blank,
+     * so the next frame is not drawn into a page that is still being scanned out
+     */
+    void flip(bool vsync);
+
+    string summary() const;
+
+private:
+    string path;
+    int fd;
+    bool device;
+    Size screen;
+    PixelFormat pixel_format;
+    int bytes_per_pixel;
+    int line_length;        // in bytes
+    int n_pages;
+    int back;
+    uchar* mapping;
+    size_t mapping_size;
+
+    uchar* page(int index) { return mapping + static_cast<size_t>(index) * line_length * screen.height; }
+};
+
+
+}
@@ -0,0 +1,139 @@
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lut_cache.hpp"
+
+
+namespace ins
+{
+
+
+static const char LUT_FILE_MAGIC[8] = { 'I', 'N', 'S', 'L', 'U', 'T', '\0', '\0' };
+static const uint32_t LUT_FILE_VERSION = 1;
+
+struct LUTFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t kind;
+    uint64_t key;
+    uint32_t n_entries;
+    uint8_t reserved[36];
+};
+
+static_assert(sizeof(LUTFileHeader) == 64, "the table must stay 64-byte aligned in the file");
+
+
+uint64_t lut_cache_key(const Warp& warp, const Geometry& geometry, PixelFormat format)
+{
+    /* FNV-1a */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    auto feed = [&](const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ULL;
+        }
+    };
+
+    warp.describe(feed);
+    int layout[] = { geometry.source.width, geometry.source.height, geometry.source_stride,
+                     geometry.screen.width, geometry.screen.height, geometry.screen_stride };
+    feed(layout, sizeof(layout));
+    int pixel_format = static_cast<int>(format);
+    feed(&pixel_format, sizeof(pixel_format));
+
+    return hash;
+}
+
+
+MappedLUTFile::MappedLUTFile(void* mapping, size_t mapping_size, uint32_t table_kind, int n_entries)
+    : mapping(mapping), mapping_size(mapping_size), table_kind(table_kind), n_entries(n_entries)
+{
+}
+
+MappedLUTFile::~MappedLUTFile()
+{
+    munmap(mapping, mapping_size);
+}
+
+shared_ptr<MappedLUTFile> MappedLUTFile::open(const string& path, uint32_t table_kind, uint64_t key, int flags)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) < sizeof(LUTFileHeader))
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    size_t mapping_size = file_stat.st_size;
+    int mmap_flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (flags & POPULATE)
+        mmap_flags |= MAP_POPULATE;
+#endif
+    void* mapping = mmap(nullptr, mapping_size, PROT_READ, mmap_flags, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return nullptr;
+
+#ifdef MADV_HUGEPAGE
+    if (flags & HUGEPAGES)
+        madvise(mapping, mapping_size, MADV_HUGEPAGE);
+#endif
+
+    const LUTFileHeader* header = static_cast<const LUTFileHeader*>(mapping);
+    if (memcmp(header->magic, LUT_FILE_MAGIC, sizeof(LUT_FILE_MAGIC)) != 0 ||
+        header->version != LUT_FILE_VERSION ||
+        header->kind != table_kind ||
+        header->key != key ||
+        mapping_size != sizeof(LUTFileHeader) + header->n_entries * sizeof(uint32_t))
+    {
+        munmap(mapping, mapping_size);
+        return nullptr;
+    }
+
+    return shared_ptr<MappedLUTFile>(new MappedLUTFile(mapping, mapping_size, table_kind, static_cast<int>(header->n_entries)));
+}
+
+void MappedLUTFile::save(const string& path, uint32_t table_kind, uint64_t key, const uint32_t* table, int n_entries)
+{
+    LUTFileHeader header = {};
+    memcpy(header.magic, LUT_FILE_MAGIC, sizeof(LUT_FILE_MAGIC));
+    header.version = LUT_FILE_VERSION;
+    header.kind = table_kind;
+    header.key = key;
+    header.n_entries = static_cast<uint32_t>(n_entries);
+
+    /* written under a temporary name and renamed, so a concurrent reader never maps a half-written table */
+    string temporary_path = path + ".tmp";
+    FILE* file = fopen(temporary_path.c_str(), "wb");
+    if (!file)
+        CV_Error(Error::StsError, "Failed to create LUT file " + temporary_path);
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(table, sizeof(uint32_t), n_entries, file) == static_cast<size_t>(n_entries);
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temporary_path.c_str(), path.c_str()) != 0)
+    {
+        remove(temporary_path.c_str());
+        CV_Error(Error::StsError, "Failed to write LUT file " + path);
+    }
+}
+
+const uint32_t* MappedLUTFile::data() const
+{
+    return reinterpret_cast<const uint32_t*>(static_cast<const uint8_t*>(mapping) + sizeof(LUTFileHeader));
+}
+
+
+}
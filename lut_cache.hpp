@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <opencv2/core.hpp>
+#include "common.hpp"
+
+using namespace std;
+using namespace cv;
+
+
+namespace ins
+{
+
+
+/* Hash of everything a LUT depends on; tables built from the same inputs share a key
+ */
+uint64_t lut_cache_key(const Warp& warp, const Geometry& geometry, PixelFormat format);
+
+
+/* Read-only memory mapping of a versioned on-disk LUT
+ *
+ * Layout: a 64-byte header (magic, version, table kind, entry count, key) followed by the 32-bit entries.
+ */
+class MappedLUTFile
+{
+private:
+    void* mapping;
+    size_t mapping_size;
+    uint32_t table_kind;
+    int n_entries;
+    MappedLUTFile(void* mapping, size_t mapping_size, uint32_t table_kind, int n_entries);
+public:
+    enum Flags
+    {
+        POPULATE = 1,   // prefault the whole table at startup (MAP_POPULATE)
+        HUGEPAGES = 2   // ask for transparent huge pages (MADV_HUGEPAGE), if the file system supports it
+    };
+
+    ~MappedLUTFile();
+    MappedLUTFile(const MappedLUTFile&) = delete;
+    MappedLUTFile& operator=(const MappedLUTFile&) = delete;
+
+    /* returns nullptr when the file does not exist or was written for another kind, key or format version */
+    static shared_ptr<MappedLUTFile> open(const string& path, uint32_t table_kind, uint64_t key, int flags = 0);
+    static void save(const string& path, uint32_t table_kind, uint64_t key, const uint32_t* table, int n_entries);
+
+    uint32_t kind() const { return table_kind; }
+    int size() const { return n_entries; }
+    const uint32_t* data() const;
+};
+
+
+}
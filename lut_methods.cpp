@@ -0,0 +1,315 @@
+#include "dirty_tiles.hpp"
+#include "lut_methods.hpp"
+
+
+namespace ins
+{
+
+
+static const vector<LUTMethod> methods = {
+    {
+        "plain", "PlainLUT",
+        "plain 1D LUT with for-loop",
+        0,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<PlainLUT>(warp, geometry, screen);
+        },
+        nullptr
+    },
+    {
+        "parallel", "ParallelLUT",
+        "multi-threaded for-loop; each thread applies LUT on their sub-region",
+        0,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<ParallelLUT>(warp, geometry, screen);
+        },
+        nullptr,
+        LUTMethod::MULTI_THREADED | LUTMethod::RACY_SCATTER
+    },
+    {
+        "plain-offset", "PlainOffsetLUT",
+        "plain 1D LUT of 32-bit screen offsets instead of pointers",
+        OffsetLUT::FILE_KIND,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<PlainOffsetLUT>(warp, geometry, screen);
+        },
+        [](shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<PlainOffsetLUT>(file, geometry, screen);
+        }
+    },
+    {
+        "parallel-offset", "ParallelOffsetLUT",
+        "multi-threaded for-loop over the 32-bit offset LUT",
+        OffsetLUT::FILE_KIND,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<ParallelOffsetLUT>(warp, geometry, screen);
+        },
+        [](shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<ParallelOffsetLUT>(file, geometry, screen);
+        },
+        LUTMethod::MULTI_THREADED | LUTMethod::RACY_SCATTER
+    },
+    {
+        "plain-reverse", "PlainReverseLUT",
+        "destination-ordered (gather) LUT; sequential writes, no holes",
+        ReverseLUT::FILE_KIND,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<PlainReverseLUT>(warp, geometry, screen);
+        },
+        [](shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<PlainReverseLUT>(file, geometry, screen);
+        }
+    },
+    {
+        "parallel-reverse", "ParallelReverseLUT",
+        "multi-threaded gather; each thread fills their own screen sub-region",
+        ReverseLUT::FILE_KIND,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<ParallelReverseLUT>(warp, geometry, screen);
+        },
+        [](shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<ParallelReverseLUT>(file, geometry, screen);
+        },
+        LUTMethod::MULTI_THREADED
+    },
+    {
+        "plain-incremental", "PlainIncrementalLUT",
+        "table-free gather; source coordinates computed from the homography",
+        0,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<PlainIncrementalLUT>(warp, geometry, screen, options.span);
+        },
+        nullptr
+    },
+    {
+        "parallel-incremental", "ParallelIncrementalLUT",
+        "multi-threaded table-free gather; each thread warps their own rows",
+        0,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<ParallelIncrementalLUT>(warp, geometry, screen, options.span);
+        },
+        nullptr,
+        LUTMethod::MULTI_THREADED
+    },
+    {
+        "plain-mesh", "PlainMeshLUT",
+        "gather from a sparse grid of exact coordinates; the rest is interpolated",
+        0,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<PlainMeshLUT>(warp, geometry, screen, options.grid);
+        },
+        nullptr
+    },
+    {
+        "parallel-mesh", "ParallelMeshLUT",
+        "multi-threaded sparse-grid gather; each thread warps their own rows",
+        0,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<ParallelMeshLUT>(warp, geometry, screen, options.grid);
+        },
+        nullptr,
+        LUTMethod::MULTI_THREADED
+    },
+    {
+        "plain-span", "PlainSpanLUT",
+        "run-length compressed LUT; each run is copied in bulk",
+        0,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<PlainSpanLUT>(warp, geometry, screen);
+        },
+        nullptr
+    },
+    {
+        "parallel-span", "ParallelSpanLUT",
+        "multi-threaded run-length compressed LUT",
+        0,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<ParallelSpanLUT>(warp, geometry, screen);
+        },
+        nullptr,
+        LUTMethod::MULTI_THREADED
+    },
+    {
+        "plain-tiled", "PlainTiledLUT",
+        "(src, dst) LUT reordered into screen tiles",
+        0,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<PlainTiledLUT>(warp, geometry, screen, options.tile_size);
+        },
+        nullptr
+    },
+    {
+        "parallel-tiled", "ParallelTiledLUT",
+        "multi-threaded tiled LUT; each thread applies whole tiles",
+        0,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<ParallelTiledLUT>(warp, geometry, screen, options.tile_size);
+        },
+        nullptr,
+        LUTMethod::MULTI_THREADED
+    },
+    {
+        "plain-simd-gather", "PlainSimdReverseLUT",
+        "reverse LUT with SSE4.1/AVX2/AVX-512 gather picked at runtime",
+        ReverseLUT::FILE_KIND,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<PlainSimdReverseLUT>(warp, geometry, screen, options.isa);
+        },
+        [](shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<PlainSimdReverseLUT>(file, geometry, screen, options.isa);
+        }
+    },
+    {
+        "parallel-simd-gather", "ParallelSimdReverseLUT",
+        "multi-threaded SIMD gather",
+        ReverseLUT::FILE_KIND,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<ParallelSimdReverseLUT>(warp, geometry, screen, options.isa);
+        },
+        [](shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<ParallelSimdReverseLUT>(file, geometry, screen, options.isa);
+        },
+        LUTMethod::MULTI_THREADED
+    },
+    {
+        "plain-simd-scatter", "PlainSimdOffsetLUT",
+        "offset LUT with AVX-512 scatter when the CPU has it",
+        OffsetLUT::FILE_KIND,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<PlainSimdOffsetLUT>(warp, geometry, screen, options.isa);
+        },
+        [](shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<PlainSimdOffsetLUT>(file, geometry, screen, options.isa);
+        }
+    },
+    {
+        "parallel-simd-scatter", "ParallelSimdOffsetLUT",
+        "multi-threaded SIMD scatter",
+        OffsetLUT::FILE_KIND,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<ParallelSimdOffsetLUT>(warp, geometry, screen, options.isa);
+        },
+        [](shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<ParallelSimdOffsetLUT>(file, geometry, screen, options.isa);
+        },
+        LUTMethod::MULTI_THREADED | LUTMethod::RACY_SCATTER
+    },
+    {
+        "plain-bilinear", "PlainBilinearLUT",
+        "reverse LUT with packed 4-bit weights; blends 2x2 source pixels",
+        0,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<PlainBilinearLUT>(warp, geometry, screen);
+        },
+        nullptr
+    },
+    {
+        "parallel-bilinear", "ParallelBilinearLUT",
+        "multi-threaded bilinear LUT",
+        0,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<ParallelBilinearLUT>(warp, geometry, screen);
+        },
+        nullptr,
+        LUTMethod::MULTI_THREADED
+    },
+    {
+        "plain-format", "PlainFormatLUT",
+        "reverse LUT on frames in their native pixel format (--format)",
+        0,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<PlainFormatLUT>(warp, geometry, screen, options.format);
+        },
+        nullptr,
+        LUTMethod::NATIVE_FORMATS
+    },
+    {
+        "parallel-format", "ParallelFormatLUT",
+        "multi-threaded native pixel format LUT",
+        0,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<ParallelFormatLUT>(warp, geometry, screen, options.format);
+        },
+        nullptr,
+        LUTMethod::NATIVE_FORMATS | LUTMethod::MULTI_THREADED
+    },
+    {
+        "dirty-tiles", "DirtyTileLUT",
+        "multi-threaded gather indexed by source tile; can re-warp only changed tiles",
+        0,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<DirtyTileLUT>(warp, geometry, screen, options.tile_size);
+        },
+        nullptr,
+        LUTMethod::MULTI_THREADED
+    },
+#ifdef __arm__
+    {
+        "plain-o1", "LoadStoreMultipleLUT",
+        "plain 1D LUT with general purpose registers and LDM STM instructions",
+        0,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<LoadStoreMultipleLUT>(warp, geometry, screen);
+        },
+        nullptr
+    },
+    {
+        "parallel-o1", "ParallelLoadStoreMultipleLUT",
+        "multi-threaded optimized for-loop; same optimization scheme as plain-o1",
+        0,
+        [](const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) -> unique_ptr<LUT> {
+            return make_unique<ParallelLoadStoreMultipleLUT>(warp, geometry, screen);
+        },
+        nullptr,
+        LUTMethod::MULTI_THREADED | LUTMethod::RACY_SCATTER
+    },
+#endif
+};
+
+
+unique_ptr<LUT> LUTMethod::create(const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) const
+{
+    unique_ptr<LUT> lut = build(warp, geometry, screen, options);
+    lut->set_thread_pool(options.pool);
+    lut->set_profiler(options.profiler);
+    return lut;
+}
+
+unique_ptr<LUT> LUTMethod::load(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* screen, const LUTOptions& options) const
+{
+    unique_ptr<LUT> lut = build_from_file(file, geometry, screen, options);
+    lut->set_thread_pool(options.pool);
+    lut->set_profiler(options.profiler);
+    return lut;
+}
+
+
+const vector<LUTMethod>& lut_methods()
+{
+    return methods;
+}
+
+const LUTMethod* find_lut_method(const string& name)
+{
+    for (const LUTMethod& method : methods)
+    {
+        if (method.name == name)
+            return &method;
+    }
+    return nullptr;
+}
+
+string lut_methods_help()
+{
+    string help;
+    for (const LUTMethod& method : methods)
+    {
+        char line[256];
+        snprintf(line, sizeof(line), "        %-22s %s\n", method.name.c_str(), method.description.c_str());
+        help += line;
+    }
+    return help;
+}
+
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "common.hpp"
+#include "lut_cache.hpp"
+#include "perf_counters.hpp"
+#include "thread_pool.hpp"
+
+using namespace std;
+using namespace cv;
+
+
+namespace ins
+{
+
+
+/* Tuning knobs of the individual methods; methods ignore the ones they do not use
+ */
+struct LUTOptions
+{
+    int span = 1;
+    int grid = 16;      // mesh methods: screen pixels between grid nodes
+    Size tile_size = Size(64, 64);
+    SimdISA isa = detect_simd_isa();
+    PixelFormat format = PixelFormat::BGRA32;
+    shared_ptr<ThreadPool> pool;    // runs the per-frame loops of the parallel methods; nullptr for cv::parallel_for_
+    shared_ptr<LUTProfiler> profiler;   // reads hardware counters around the parallel partitions; nullptr for none
+};
+
+
+/* A LUT method selectable by name from app.out
+ */
+struct LUTMethod
+{
+    enum Flags
+    {
+        NATIVE_FORMATS = 1,     // accepts every PixelFormat; other methods take BGRA32 frames only
+        MULTI_THREADED = 2,     // runs its frames on the parallel backend (LUTOptions::pool)
+        RACY_SCATTER = 4        // threads scatter concurrently, so where several source pixels land on one screen pixel
+                                // which of them ends up there varies from frame to frame
+    };
+
+    string name;
+    string class_name;
+    string description;
+    uint32_t file_kind;    // MappedLUTFile kind the method can be loaded from, 0 if it cannot be cached
+    function<unique_ptr<LUT>(const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options)> build;
+    function<unique_ptr<LUT>(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* screen, const LUTOptions& options)> build_from_file;
+    unsigned flags = 0;
+
+    bool has(Flags flag) const { return (flags & flag) != 0; }
+
+    /* build or build_from_file, with the options' thread pool and profiler attached */
+    unique_ptr<LUT> create(const Warp& warp, const Geometry& geometry, uint* screen, const LUTOptions& options) const;
+    unique_ptr<LUT> load(shared_ptr<MappedLUTFile> file, const Geometry& geometry, uint* screen, const LUTOptions& options) const;
+};
+
+
+const vector<LUTMethod>& lut_methods();
+const LUTMethod* find_lut_method(const string& name);
+string lut_methods_help();
+
+
+}
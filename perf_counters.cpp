@@ -0,0 +1,267 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "perf_counters.hpp"
+
+
+namespace ins
+{
+
+
+PerfSample& PerfSample::operator+=(const PerfSample& other)
+{
+    for (int e = 0; e < N_EVENTS; e++)
+        counts[e] += other.counts[e];
+    return *this;
+}
+
+PerfSample PerfSample::operator-(const PerfSample& other) const
+{
+    PerfSample difference;
+    for (int e = 0; e < N_EVENTS; e++)
+        difference.counts[e] = counts[e] - other.counts[e];
+    return difference;
+}
+
+
+#ifdef __linux__
+static int open_event(uint32_t type, uint64_t config, int group_fd)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group_fd < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+
+static uint64_t cache_event(uint64_t cache, uint64_t op, uint64_t result)
+{
+    return cache | (op << 8) | (result << 16);
+}
+#endif
+
+PerfCounters::PerfCounters()
+    : leader(-1)
+{
+    for (int e = 0; e < PerfSample::N_EVENTS; e++)
+        fds[e] = -1;
+
+#ifdef __linux__
+    /* alternatives in order of preference; the first that opens is the event */
+    const vector<pair<uint32_t, uint64_t>> choices[PerfSample::N_EVENTS] = {
+        { { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES } },
+        { { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS } },
+        { { PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+          { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES } },
+        { { PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS) } },
+    };
+
+    for (int e = 0; e < PerfSample::N_EVENTS; e++)
+    {
+        for (const auto& choice : choices[e])
+        {
+            fds[e] = open_event(choice.first, choice.second, leader);
+            if (fds[e] >= 0)
+                break;
+        }
+        if (fds[e] >= 0 && leader < 0)
+            leader = fds[e];
+        else if (fds[e] < 0 && leader < 0 && unavailable_reason.empty())
+            unavailable_reason = string("perf_event_open failed: ") + strerror(errno);
+    }
+
+    if (leader >= 0)
+    {
+        unavailable_reason.clear();
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#else
+    unavailable_reason = "hardware counters need Linux perf_event_open";
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+    for (int e = 0; e < PerfSample::N_EVENTS; e++)
+    {
+        if (fds[e] >= 0)
+            close(fds[e]);
+    }
+#endif
+}
+
+PerfSample PerfCounters::read() const
+{
+    PerfSample sample;
+#ifdef __linux__
+    if (leader < 0)
+        return sample;
+
+    /* group layout: number of events, time enabled, time running, then the values in the order they were opened */
+    uint64_t buffer[3 + PerfSample::N_EVENTS];
+    if (::read(leader, buffer, sizeof(buffer)) < static_cast<ssize_t>(3 * sizeof(uint64_t)))
+        return sample;
+
+    double scale = buffer[2] > 0 && buffer[2] < buffer[1] ? static_cast<double>(buffer[1]) / buffer[2] : 1.;
+    int value = 3;
+    for (int e = 0; e < PerfSample::N_EVENTS; e++)
+    {
+        if (fds[e] >= 0 && value < 3 + static_cast<int>(buffer[0]))
+            sample.counts[e] = static_cast<uint64_t>(buffer[value++] * scale);
+    }
+#endif
+    return sample;
+}
+
+
+/* one group per thread, shared by every profiler the thread reports to */
+static PerfCounters& thread_counters()
+{
+    static thread_local unique_ptr<PerfCounters> counters;
+    if (!counters)
+        counters = make_unique<PerfCounters>();
+    return *counters;
+}
+
+LUTProfiler::LUTProfiler()
+{
+    PerfCounters& counters = thread_counters();
+    counters_available = counters.available();
+    unavailable_reason = counters.reason();
+    for (int e = 0; e < PerfSample::N_EVENTS; e++)
+        available_events[e] = counters.has(static_cast<PerfSample::Event>(e));
+}
+
+void LUTProfiler::measure_apply(const function<void()>& apply)
+{
+    PerfCounters& counters = thread_counters();
+    PerfSample before = counters.read();
+    auto start = chrono::steady_clock::now();
+    apply();
+    auto end = chrono::steady_clock::now();
+    PerfSample events = counters.read() - before;
+
+    lock_guard<mutex> lock(figures_mutex);
+    applies.events += events;
+    applies.busy_us += chrono::duration<double, micro>(end - start).count();
+    applies.count++;
+}
+
+void LUTProfiler::measure_partition(const Range& range, const function<void(const Range&)>& body)
+{
+    PerfCounters& counters = thread_counters();
+    PerfSample before = counters.read();
+    auto start = chrono::steady_clock::now();
+    body(range);
+    auto end = chrono::steady_clock::now();
+    PerfSample events = counters.read() - before;
+
+    lock_guard<mutex> lock(figures_mutex);
+    auto found = thread_index.emplace(this_thread::get_id(), static_cast<int>(threads.size()));
+    if (found.second)
+        threads.emplace_back();
+    Figures& figures = threads[found.first->second];
+    figures.events += events;
+    figures.busy_us += chrono::duration<double, micro>(end - start).count();
+    figures.count++;
+}
+
+void LUTProfiler::reset()
+{
+    lock_guard<mutex> lock(figures_mutex);
+    applies = Figures();
+    thread_index.clear();
+    threads.clear();
+}
+
+PerfSample LUTProfiler::per_frame() const
+{
+    lock_guard<mutex> lock(figures_mutex);
+    PerfSample total;
+    if (threads.empty())
+        total = applies.events;
+    for (const Figures& figures : threads)
+        total += figures.events;
+
+    PerfSample frame;
+    for (int e = 0; e < PerfSample::N_EVENTS; e++)
+        frame.counts[e] = applies.count > 0 ? total.counts[e] / applies.count : 0;
+    return frame;
+}
+
+static string format_count(double count)
+{
+    char buffer[32];
+    if (count >= 1e6)
+        snprintf(buffer, sizeof(buffer), "%.2f M", count / 1e6);
+    else if (count >= 1e3)
+        snprintf(buffer, sizeof(buffer), "%.1f k", count / 1e3);
+    else
+        snprintf(buffer, sizeof(buffer), "%.0f", count);
+    return buffer;
+}
+
+string LUTProfiler::report() const
+{
+    if (!counters_available)
+        return "Hardware counters unavailable : " + unavailable_reason;
+
+    lock_guard<mutex> lock(figures_mutex);
+    int n_frames = max(1, applies.count);
+
+    /* counts per frame; the traffic estimate is one 64-byte line per LLC miss over the mean apply time */
+    auto line = [&](const string& label, const Figures& figures) {
+        const uint64_t* counts = figures.events.counts;
+        string text = label;
+        char buffer[160];
+        snprintf(buffer, sizeof(buffer), "busy %.1f us", figures.busy_us / n_frames);
+        text += buffer;
+        const char* names[] = { "cycles", "instructions", "LLC misses", "dTLB misses" };
+        for (int e = 0; e < PerfSample::N_EVENTS; e++)
+            text += string(", ") + (available_events[e] ? format_count(static_cast<double>(counts[e]) / n_frames) : "n/a") + " " + names[e];
+        if (available_events[PerfSample::CYCLES] && available_events[PerfSample::INSTRUCTIONS] && counts[PerfSample::CYCLES] > 0)
+        {
+            snprintf(buffer, sizeof(buffer), ", IPC %.2f", static_cast<double>(counts[PerfSample::INSTRUCTIONS]) / counts[PerfSample::CYCLES]);
+            text += buffer;
+        }
+        if (available_events[PerfSample::LLC_MISSES] && applies.busy_us > 0)
+        {
+            snprintf(buffer, sizeof(buffer), ", %.2f GB/s of LLC misses", counts[PerfSample::LLC_MISSES] * 64. / (applies.busy_us * 1e3));
+            text += buffer;
+        }
+        return text + "\n";
+    };
+
+    string text = "Counters per frame over " + to_string(applies.count) + " frames\n";
+    text += line("  apply (calling thread) : ", applies);
+    Figures all;
+    for (size_t t = 0; t < threads.size(); t++)
+    {
+        all.events += threads[t].events;
+        all.busy_us += threads[t].busy_us;
+        all.count += threads[t].count;
+        text += line("  thread " + to_string(t) + " (" + format_count(static_cast<double>(threads[t].count) / n_frames) + " partitions) : ", threads[t]);
+    }
+    if (threads.size() > 1)
+        text += line("  all threads : ", all);
+    text.pop_back();
+    return text;
+}
+
+
+}
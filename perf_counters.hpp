@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+
+using namespace std;
+using namespace cv;
+
+
+namespace ins
+{
+
+
+/* Hardware event counts over some stretch of one thread, or summed over threads
+ */
+struct PerfSample
+{
+    enum Event
+    {
+        CYCLES,
+        INSTRUCTIONS,
+        LLC_MISSES,     // last-level cache read misses, or the generic cache-miss event where the CPU lacks that one
+        DTLB_MISSES,    // data TLB read misses
+        N_EVENTS
+    };
+
+    uint64_t counts[N_EVENTS] = {};
+
+    PerfSample& operator+=(const PerfSample& other);
+    PerfSample operator-(const PerfSample& other) const;
+};
+
+
+/* The calling thread's perf_event_open counters for the PerfSample events, opened as one group so they are read
+ * with one system call and are scheduled onto the PMU together. Only user-space events are counted, which
+ * perf_event_paranoid allows by default. An event the CPU or kernel does not offer is left out of the group; when
+ * perf_event_open fails altogether (a container, a VM without a virtual PMU, paranoid level 3, not Linux)
+ * available() is false, read() returns zeros and reason() says why.
+ */
+class PerfCounters
+{
+public:
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available() const { return leader >= 0; }
+    bool has(PerfSample::Event event) const { return fds[event] >= 0; }
+    const string& reason() const { return unavailable_reason; }
+
+    /* counts since the group was opened, scaled up if the kernel had to multiplex the group */
+    PerfSample read() const;
+
+private:
+    int fds[PerfSample::N_EVENTS];
+    int leader;
+    string unavailable_reason;
+};
+
+
+/* Per-thread hardware counters of a LUT's frames. Attached with LUT::set_profiler, the LUT's parallel loop reads
+ * the counters of whichever thread runs each partition around that partition, and measure_apply() reads the
+ * calling thread's counters around a whole apply. Every thread opens its counters the first time it is measured
+ * and keeps them until it exits. Reading the counters is a system call per partition, so the frame times of a
+ * profiled run are somewhat longer than those of an unprofiled one.
+ */
+class LUTProfiler
+{
+public:
+    struct Figures
+    {
+        PerfSample events;
+        double busy_us = 0;
+        int count = 0;      // applies or partitions
+    };
+
+    LUTProfiler();
+
+    /* whether the calling thread could open its counters, and why not */
+    bool available() const { return counters_available; }
+    const string& reason() const { return unavailable_reason; }
+    bool has(PerfSample::Event event) const { return available_events[event]; }
+
+    void measure_apply(const function<void()>& apply);
+    void measure_partition(const Range& range, const function<void(const Range&)>& body);
+    void reset();
+
+    int frames() const { return applies.count; }
+    /* events of one frame summed over the threads that ran it, or the calling thread's when nothing ran in parallel */
+    PerfSample per_frame() const;
+    string report() const;
+
+private:
+    mutable mutex figures_mutex;
+    Figures applies;
+    map<thread::id, int> thread_index;
+    vector<Figures> threads;
+    bool counters_available;
+    bool available_events[PerfSample::N_EVENTS];
+    string unavailable_reason;
+};
+
+
+}
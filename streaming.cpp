@@ -0,0 +1,215 @@
+#include <cstdio>
+#include <thread>
+
+#include "streaming.hpp"
+
+
+namespace ins
+{
+
+
+FrameRing::FrameRing(int capacity, function<Mat()> allocate)
+    : head(0), tail(0), is_closed(false)
+{
+    CV_Assert(capacity > 0);
+
+    slots.resize(capacity);
+    for (StreamFrame& slot : slots)
+        slot.data = allocate();
+}
+
+StreamFrame* FrameRing::begin_write()
+{
+    size_t h = head.load(memory_order_relaxed);
+    if (h - tail.load(memory_order_acquire) == slots.size())
+        return nullptr;
+    return &slots[h % slots.size()];
+}
+
+void FrameRing::end_write()
+{
+    head.store(head.load(memory_order_relaxed) + 1, memory_order_release);
+}
+
+StreamFrame* FrameRing::begin_read()
+{
+    size_t t = tail.load(memory_order_relaxed);
+    if (t == head.load(memory_order_acquire))
+        return nullptr;
+    return &slots[t % slots.size()];
+}
+
+void FrameRing::end_read()
+{
+    tail.store(tail.load(memory_order_relaxed) + 1, memory_order_release);
+}
+
+void FrameRing::close()
+{
+    is_closed.store(true, memory_order_release);
+}
+
+int FrameRing::occupancy() const
+{
+    return static_cast<int>(head.load(memory_order_acquire) - tail.load(memory_order_acquire));
+}
+
+
+void StreamStats::Stage::add(double us, int n)
+{
+    mean_us += (us - mean_us) / n;
+    max_us = max(max_us, us);
+}
+
+const char* StreamStats::bottleneck() const
+{
+    if (decode.mean_us >= warp.mean_us && decode.mean_us >= present.mean_us)
+        return "decode";
+    return warp.mean_us >= present.mean_us ? "warp" : "present";
+}
+
+string StreamStats::report() const
+{
+    char buffer[768];
+    snprintf(buffer, sizeof(buffer),
+             "Frames : %d in %.2f s, %.1f FPS\n"
+             "Decode  : mean %8.1f us, max %8.1f us\n"
+             "Warp    : mean %8.1f us, max %8.1f us\n"
+             "Present : mean %8.1f us, max %8.1f us\n"
+             "Latency : mean %8.1f us, max %8.1f us (decode start to present end)\n"
+             "Queue occupancy : warp %.2f / %d, present %.2f / %d\n"
+             "Bottleneck : %s",
+             frames, seconds, fps(),
+             decode.mean_us, decode.max_us, warp.mean_us, warp.max_us, present.mean_us, present.max_us,
+             latency.mean_us, latency.max_us,
+             warp_queue_occupancy, queue_capacity, present_queue_occupancy, queue_capacity,
+             bottleneck());
+    return buffer;
+}
+
+
+StreamingPipeline::StreamingPipeline(RelocatableLUT& lut, Source source, Sink sink,
+                                     function<Mat()> allocate_frame, function<Mat()> allocate_screen, int depth)
+    : lut(lut), source(source), sink(sink), decoded(depth, allocate_frame), warped(depth, allocate_screen)
+{
+}
+
+StreamStats StreamingPipeline::run(int max_frames)
+{
+    typedef chrono::steady_clock clock;
+    auto elapsed_us = [](clock::time_point from, clock::time_point to) {
+        return chrono::duration<double, micro>(to - from).count();
+    };
+
+    StreamStats stats;
+    stats.queue_capacity = decoded.capacity();
+    atomic<bool> stopping(false);
+    int warped_frames = 0;
+    auto run_start = clock::now();
+
+    /* each stage only touches its own half of the stats, and the threads are joined before they are read */
+    thread decoder([&]{
+        for (int i = 0; i < max_frames && !stopping.load(memory_order_relaxed); i++)
+        {
+            StreamFrame* frame;
+            while (!(frame = decoded.begin_write()))
+            {
+                if (stopping.load(memory_order_relaxed))
+                    break;
+                this_thread::yield();
+            }
+            if (!frame)
+                break;
+
+            frame->captured = clock::now();
+            if (!source(frame->data))
+                break;
+            frame->sequence = i;
+            stats.decode.add(elapsed_us(frame->captured, clock::now()), i + 1);
+            decoded.end_write();
+        }
+        decoded.close();
+    });
+
+    thread warper([&]{
+        int& n = warped_frames;
+        while (true)
+        {
+            StreamFrame* frame = decoded.begin_read();
+            if (!frame)
+            {
+                if (decoded.closed() && !(frame = decoded.begin_read()))
+                    break;
+                if (!frame)
+                {
+                    this_thread::yield();
+                    continue;
+                }
+            }
+            stats.warp_queue_occupancy += decoded.occupancy();
+
+            StreamFrame* screen;
+            while (!(screen = warped.begin_write()))
+            {
+                if (stopping.load(memory_order_relaxed))
+                    break;
+                this_thread::yield();
+            }
+            if (!screen)
+                break;
+
+            auto start = clock::now();
+            lut.apply(reinterpret_cast<const uint*>(frame->data.data), reinterpret_cast<uint*>(screen->data.data));
+            stats.warp.add(elapsed_us(start, clock::now()), ++n);
+
+            screen->sequence = frame->sequence;
+            screen->captured = frame->captured;
+            decoded.end_read();
+            warped.end_write();
+        }
+        warped.close();
+    });
+
+    while (true)
+    {
+        StreamFrame* screen = warped.begin_read();
+        if (!screen)
+        {
+            if (warped.closed() && !(screen = warped.begin_read()))
+                break;
+            if (!screen)
+            {
+                this_thread::yield();
+                continue;
+            }
+        }
+        stats.present_queue_occupancy += warped.occupancy();
+
+        auto start = clock::now();
+        bool keep_going = sink(screen->data);
+        auto end = clock::now();
+        stats.frames++;
+        stats.present.add(elapsed_us(start, end), stats.frames);
+        stats.latency.add(elapsed_us(screen->captured, end), stats.frames);
+        warped.end_read();
+
+        if (!keep_going)
+        {
+            stopping.store(true, memory_order_relaxed);
+            break;
+        }
+    }
+    stats.seconds = chrono::duration<double>(clock::now() - run_start).count();
+
+    decoder.join();
+    warper.join();
+
+    if (warped_frames > 0)
+        stats.warp_queue_occupancy /= warped_frames;
+    if (stats.frames > 0)
+        stats.present_queue_occupancy /= stats.frames;
+    return stats;
+}
+
+
+}
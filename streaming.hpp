@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "common.hpp"
+
+using namespace std;
+using namespace cv;
+
+
+namespace ins
+{
+
+
+/* A preallocated frame travelling through the pipeline, stamped when its decode started
+ */
+struct StreamFrame
+{
+    Mat data;
+    int sequence;
+    chrono::steady_clock::time_point captured;
+};
+
+
+/* Bounded single-producer single-consumer ring of preallocated frames.
+ * The producer fills the slot at the head in place and the consumer reads the slot at the tail in place,
+ * so frames are never copied or allocated while streaming; head and tail are the only shared state.
+ */
+class FrameRing
+{
+public:
+    FrameRing(int capacity, function<Mat()> allocate);
+
+    StreamFrame* begin_write();     // nullptr while full
+    void end_write();
+    StreamFrame* begin_read();      // nullptr while empty
+    void end_read();
+
+    void close();                   // no more frames will be written
+    bool closed() const { return is_closed.load(memory_order_acquire); }
+    int occupancy() const;
+    int capacity() const { return static_cast<int>(slots.size()); }
+
+private:
+    vector<StreamFrame> slots;
+    alignas(64) atomic<size_t> head;
+    alignas(64) atomic<size_t> tail;
+    atomic<bool> is_closed;
+};
+
+
+/* Per-stage service times, end-to-end latency and queue occupancy of a streaming run
+ */
+struct StreamStats
+{
+    struct Stage
+    {
+        double mean_us = 0;
+        double max_us = 0;
+        void add(double us, int n);
+    };
+
+    int frames = 0;
+    double seconds = 0;
+    Stage decode, warp, present, latency;
+    double warp_queue_occupancy = 0;       // mean frames in the warp queue, including the one being warped
+    double present_queue_occupancy = 0;    // mean frames in the present queue, including the one being presented
+    int queue_capacity = 0;
+
+    double fps() const { return seconds > 0 ? frames / seconds : 0; }
+    const char* bottleneck() const;
+    string report() const;
+};
+
+
+/* Runs decode -> warp -> present as three stages joined by FrameRings.
+ * Decode and warp get their own threads; present runs on the calling thread, so it may use HighGUI.
+ */
+class StreamingPipeline
+{
+public:
+    typedef function<bool(Mat& frame)> Source;          // fills the frame in place; false at end of stream
+    typedef function<bool(const Mat& screen)> Sink;     // false to stop early
+
+    StreamingPipeline(RelocatableLUT& lut, Source source, Sink sink,
+                      function<Mat()> allocate_frame, function<Mat()> allocate_screen, int depth = 3);
+
+    StreamStats run(int max_frames);
+
+private:
+    RelocatableLUT& lut;
+    Source source;
+    Sink sink;
+    FrameRing decoded;
+    FrameRing warped;
+};
+
+
+}
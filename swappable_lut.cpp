@@ -0,0 +1,104 @@
+#include "swappable_lut.hpp"
+
+
+namespace ins
+{
+
+
+SwappableLUT::SwappableLUT(Factory factory, unique_ptr<LUT> initial, Size source_size)
+    : LUT(initial->size()), factory(factory), source_size(source_size), current(move(initial)), swaps(0), failures(0)
+{
+    builder = thread(&SwappableLUT::build_loop, this);
+}
+
+SwappableLUT::~SwappableLUT()
+{
+    {
+        lock_guard<mutex> lock(state_mutex);
+        stopping = true;
+    }
+    state_changed.notify_all();
+    builder.join();
+}
+
+void SwappableLUT::apply(const uint* image_data)
+{
+    /* the local reference keeps the old table alive until this frame is done, even if a swap happens meanwhile */
+    shared_ptr<LUT> lut = atomic_load(&current);
+    lut->apply(image_data);
+}
+
+string SwappableLUT::summary() const
+{
+    return atomic_load(&current)->summary();
+}
+
+int SwappableLUT::size() const
+{
+    return atomic_load(&current)->size();
+}
+
+void SwappableLUT::recalibrate(vector<Point2f> desired_points)
+{
+    {
+        lock_guard<mutex> lock(state_mutex);
+        requested_points = desired_points;
+        has_request = true;
+    }
+    state_changed.notify_one();
+}
+
+bool SwappableLUT::rebuilding() const
+{
+    lock_guard<mutex> lock(state_mutex);
+    return has_request || building;
+}
+
+string SwappableLUT::last_failure() const
+{
+    lock_guard<mutex> lock(state_mutex);
+    return failure_message;
+}
+
+void SwappableLUT::build_loop()
+{
+    unique_lock<mutex> lock(state_mutex);
+
+    while (true)
+    {
+        state_changed.wait(lock, [&]{ return stopping || has_request; });
+        if (stopping)
+            break;
+
+        vector<Point2f> points = requested_points;
+        has_request = false;
+        building = true;
+        lock.unlock();
+
+        /* a failed rebuild must not take the render loop down with it; the frames keep using the current table */
+        bool failed = false;
+        string error;
+        try
+        {
+            shared_ptr<LUT> lut = factory(get_transform_matrix(points, source_size));
+            atomic_store(&current, lut);
+            swaps++;
+        }
+        catch (const exception& e)
+        {
+            failed = true;
+            error = e.what();
+        }
+
+        lock.lock();
+        if (failed)
+        {
+            failure_message = error;
+            failures++;
+        }
+        building = false;
+    }
+}
+
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "common.hpp"
+
+using namespace std;
+using namespace cv;
+
+
+namespace ins
+{
+
+
+/* Holds the LUT used by the render loop and rebuilds it on a background thread when the corner points change.
+ * A finished table is published with an atomic pointer swap, so apply() never waits for a rebuild
+ * and a frame is always produced entirely by either the old or the new table.
+ * A rebuild that throws keeps the current table; the failure is counted and its message kept.
+ */
+class SwappableLUT : public LUT
+{
+public:
+    typedef function<unique_ptr<LUT>(Mat transform_matrix)> Factory;
+
+    SwappableLUT(Factory factory, unique_ptr<LUT> initial, Size source_size = Size(DISPLAY_W, DISPLAY_H));
+    ~SwappableLUT();
+
+    void apply(const uint* image_data) override;
+    string summary() const override;
+    /* the size of the current table, which changes with the corners for the clipped scatter tables */
+    int size() const override;
+
+    /* requests a rebuild; while one is running, only the latest request is kept */
+    void recalibrate(vector<Point2f> desired_points);
+
+    int swap_count() const { return swaps.load(); }
+    bool rebuilding() const;
+    int failure_count() const { return failures.load(); }
+    string last_failure() const;
+
+private:
+    Factory factory;
+    Size source_size;
+    shared_ptr<LUT> current;
+
+    mutable mutex state_mutex;
+    condition_variable state_changed;
+    bool has_request = false;
+    bool building = false;
+    bool stopping = false;
+    vector<Point2f> requested_points;
+    string failure_message;
+    atomic<int> swaps;
+    atomic<int> failures;
+    thread builder;
+
+    void build_loop();
+};
+
+
+}
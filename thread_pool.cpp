@@ -0,0 +1,179 @@
+#include <cstdio>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "thread_pool.hpp"
+
+
+namespace ins
+{
+
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+/* Busy-waits until ready() holds or the spin time is over; returns whether ready() held
+ */
+template<typename Ready>
+static bool spin_until(Ready ready, chrono::microseconds spin)
+{
+    auto deadline = chrono::steady_clock::now() + spin;
+    for (int i = 1; ; i++)
+    {
+        if (ready())
+            return true;
+        if (i % 64 == 0 && chrono::steady_clock::now() >= deadline)
+            return false;
+        cpu_relax();
+    }
+}
+
+
+ThreadPool::ThreadPool(int n_threads, const vector<int>& cpus, Schedule schedule, chrono::microseconds spin)
+    : n_threads(n_threads), cpus(cpus), schedule(schedule), spin(spin),
+      body(nullptr), align(1), chunk(0), next_chunk(0), generation(0), pending(0), stopping(false)
+{
+    CV_Assert(n_threads >= 1);
+
+    for (int i = 1; i < n_threads; i++)
+    {
+        workers.emplace_back(&ThreadPool::worker_loop, this, i);
+#ifdef __linux__
+        if (!cpus.empty())
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[i % cpus.size()], &set);
+            if (pthread_setaffinity_np(workers.back().native_handle(), sizeof(set), &set) != 0)
+                printf("Warning: failed to pin worker %d to CPU %d\n", i, cpus[i % cpus.size()]);
+        }
+#endif
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(park_mutex);
+        stopping.store(true, memory_order_release);
+    }
+    wake.notify_all();
+    for (thread& worker : workers)
+        worker.join();
+}
+
+void ThreadPool::run(const Range& range, const function<void(const Range&)>& body, int align)
+{
+    if (range.end <= range.start)
+        return;
+    if (n_threads == 1)
+    {
+        body(range);
+        return;
+    }
+
+    this->body = &body;
+    this->range = range;
+    this->align = max(1, align);
+    int pieces = schedule == Schedule::DYNAMIC ? n_threads * 4 : n_threads;
+    chunk = (range.size() + pieces - 1) / pieces;
+    chunk = (chunk + this->align - 1) / this->align * this->align;
+    next_chunk.store(0, memory_order_relaxed);
+    pending.store(n_threads - 1, memory_order_relaxed);
+
+    /* bumped under the lock, so a worker about to park either sees the new generation or gets the notification */
+    {
+        lock_guard<mutex> lock(park_mutex);
+        generation.fetch_add(1, memory_order_release);
+    }
+    wake.notify_all();
+
+    run_share(0);
+
+    auto done = [&]{ return pending.load(memory_order_acquire) == 0; };
+    if (!spin_until(done, spin))
+    {
+        unique_lock<mutex> lock(park_mutex);
+        finished.wait(lock, done);
+    }
+}
+
+void ThreadPool::worker_loop(int index)
+{
+    uint64_t seen = 0;
+    auto has_work = [&]{
+        return stopping.load(memory_order_acquire) || generation.load(memory_order_acquire) != seen;
+    };
+
+    while (true)
+    {
+        if (!spin_until(has_work, spin))
+        {
+            unique_lock<mutex> lock(park_mutex);
+            wake.wait(lock, has_work);
+        }
+        if (stopping.load(memory_order_acquire))
+            return;
+
+        /* run() waits for every worker before it starts the next loop, so exactly one generation has passed */
+        seen++;
+        run_share(index);
+
+        if (pending.fetch_sub(1, memory_order_acq_rel) == 1)
+        {
+            lock_guard<mutex> lock(park_mutex);
+            finished.notify_one();
+        }
+    }
+}
+
+void ThreadPool::run_share(int index)
+{
+    if (schedule == Schedule::STATIC)
+    {
+        int begin = range.start + index * chunk;
+        int end = min(range.end, begin + chunk);
+        if (begin < end)
+            (*body)(Range(begin, end));
+        return;
+    }
+
+    while (true)
+    {
+        int begin = range.start + next_chunk.fetch_add(1, memory_order_relaxed) * chunk;
+        if (begin >= range.end)
+            break;
+        (*body)(Range(begin, min(range.end, begin + chunk)));
+    }
+}
+
+string ThreadPool::summary() const
+{
+    string pinned = "not pinned";
+    if (!cpus.empty())
+    {
+        pinned = "pinned to CPUs";
+        for (int i = 0; i < n_threads; i++)
+            pinned += (i ? "," : " ") + to_string(cpus[i % cpus.size()]);
+    }
+
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "thread pool : %d threads, %s schedule, spin %lld us, %s",
+             n_threads, schedule == Schedule::STATIC ? "static" : "dynamic", static_cast<long long>(spin.count()), pinned.c_str());
+    return buffer;
+}
+
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/core.hpp>
+
+using namespace std;
+using namespace cv;
+
+
+namespace ins
+{
+
+
+/* Persistent workers for the per-frame loops of the parallel LUTs, as an alternative to cv::parallel_for_.
+ * The workers stay alive between frames and wait for the next loop by spinning for a short while and only then
+ * parking on a condition variable, so a frame that follows closely is dispatched without a wake-up system call.
+ * The calling thread runs the first partition itself. Partition boundaries are multiples of the requested
+ * alignment (e.g. a cache line of pixels), so two threads never write the same screen cache line of a gather.
+ *
+ * run() is not reentrant and must be called by one thread at a time.
+ */
+class ThreadPool
+{
+public:
+    enum class Schedule
+    {
+        STATIC,     // one contiguous partition per thread
+        DYNAMIC     // threads take aligned chunks from a shared counter until the range is done
+    };
+
+    /* n_threads includes the calling thread; worker i is pinned to cpus[i % cpus.size()] unless cpus is empty,
+     * and the caller, which takes partition 0, is expected to be pinned to cpus[0] by the application
+     */
+    ThreadPool(int n_threads, const vector<int>& cpus = {}, Schedule schedule = Schedule::STATIC,
+               chrono::microseconds spin = chrono::microseconds(100));
+    ~ThreadPool();
+
+    void run(const Range& range, const function<void(const Range&)>& body, int align = 1);
+
+    int size() const { return n_threads; }
+    string summary() const;
+
+private:
+    int n_threads;
+    vector<int> cpus;
+    Schedule schedule;
+    chrono::microseconds spin;
+    vector<thread> workers;
+
+    /* the loop being run; written by run() before the generation is bumped */
+    const function<void(const Range&)>* body;
+    Range range;
+    int align;
+    int chunk;
+    alignas(64) atomic<int> next_chunk;
+
+    alignas(64) atomic<uint64_t> generation;
+    alignas(64) atomic<int> pending;
+    atomic<bool> stopping;
+    mutex park_mutex;
+    condition_variable wake;
+    condition_variable finished;
+
+    void worker_loop(int index);
+    void run_share(int index);
+};
+
+
+}
@@ -0,0 +1,285 @@
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+
+#include "warp.hpp"
+
+
+namespace ins
+{
+
+
+/* the arithmetic of perspectiveTransform, so the points match the homography tables exactly */
+static Point2f project(const Matx33d& m, double x, double y)
+{
+    double w = x * m(2, 0) + y * m(2, 1) + m(2, 2);
+    w = fabs(w) > FLT_EPSILON ? 1. / w : 0;
+    return Point2f(static_cast<float>((x * m(0, 0) + y * m(0, 1) + m(0, 2)) * w),
+                   static_cast<float>((x * m(1, 0) + y * m(1, 1) + m(1, 2)) * w));
+}
+
+static const Point2f NO_POINT(-1, -1);
+
+
+Warp::Warp()
+    : warp_kind(HOMOGRAPHY), norm(1), k1(0), k2(0)
+{
+}
+
+Warp::Warp(Mat homography)
+    : Warp()
+{
+    CV_Assert(homography.rows == 3 && homography.cols == 3 && homography.channels() == 1);
+    homography.convertTo(matrix, CV_64FC1);
+}
+
+Warp Warp::radial(Mat homography, Size screen, double k1, double k2)
+{
+    CV_Assert(screen.width > 0 && screen.height > 0);
+    Warp warp(homography);
+    warp.warp_kind = RADIAL;
+    warp.center = Point2d((screen.width - 1) / 2., (screen.height - 1) / 2.);
+    warp.norm = hypot(screen.width, screen.height) / 2;
+    warp.k1 = k1;
+    warp.k2 = k2;
+    return warp;
+}
+
+Warp Warp::from_maps(Mat map_x, Mat map_y)
+{
+    Warp warp;
+    warp.warp_kind = MAP;
+    if (map_y.empty())
+    {
+        CV_Assert(!map_x.empty() && map_x.channels() == 2);
+        map_x.convertTo(warp.map, CV_32FC2);
+    }
+    else
+    {
+        CV_Assert(map_x.channels() == 1 && map_y.channels() == 1 && map_x.size() == map_y.size());
+        Mat x, y;
+        map_x.convertTo(x, CV_32FC1);
+        map_y.convertTo(y, CV_32FC1);
+        merge(vector<Mat>{ x, y }, warp.map);
+    }
+    return warp;
+}
+
+Warp Warp::from_offsets(Mat offsets, int source_stride)
+{
+    CV_Assert(!offsets.empty() && offsets.type() == CV_32SC1 && source_stride > 0);
+    Mat map(offsets.size(), CV_32FC2);
+    for (int y = 0; y < offsets.rows; y++)
+    {
+        const int* offset = offsets.ptr<int>(y);
+        Point2f* point = map.ptr<Point2f>(y);
+        for (int x = 0; x < offsets.cols; x++)
+            point[x] = offset[x] < 0 ? NO_POINT : Point2f(static_cast<float>(offset[x] % source_stride), static_cast<float>(offset[x] / source_stride));
+    }
+    return from_maps(map, Mat());
+}
+
+Warp Warp::load(const string& path)
+{
+    FileStorage file(path, FileStorage::READ);
+    if (!file.isOpened())
+        CV_Error(Error::StsError, "cannot open the warp map " + path);
+
+    Mat map_x, map_y, map_xy, offsets;
+    file["map_x"] >> map_x;
+    file["map_y"] >> map_y;
+    file["map_xy"] >> map_xy;
+    file["offsets"] >> offsets;
+    if (!map_x.empty() && !map_y.empty())
+        return from_maps(map_x, map_y);
+    if (!map_xy.empty())
+        return from_maps(map_xy, Mat());
+    if (!offsets.empty())
+        return from_offsets(offsets, static_cast<int>(file["source_stride"]));
+    CV_Error(Error::StsBadArg, path + " holds neither map_x and map_y, map_xy nor offsets");
+}
+
+const Mat& Warp::homography() const
+{
+    CV_Assert(warp_kind != MAP);
+    return matrix;
+}
+
+Point2d Warp::distort(Point2d point) const
+{
+    Point2d d = point - center;
+    double r2 = (d.x * d.x + d.y * d.y) / (norm * norm);
+    return center + d * (1 + k1 * r2 + k2 * r2 * r2);
+}
+
+/* Newton's method on r (1 + k1 r^2 + k2 r^4) = r_distorted; fails where the model folds over */
+bool Warp::undistort(Point2d point, Point2d& undistorted) const
+{
+    Point2d d = point - center;
+    double rd = hypot(d.x, d.y) / norm;
+    if (rd == 0)
+    {
+        undistorted = point;
+        return true;
+    }
+
+    double r = rd;
+    for (int i = 0; i < 20; i++)
+    {
+        double r2 = r * r;
+        double slope = 1 + 3 * k1 * r2 + 5 * k2 * r2 * r2;
+        if (slope <= 0)
+            return false;
+        double step = (r * (1 + k1 * r2 + k2 * r2 * r2) - rd) / slope;
+        r -= step;
+        if (fabs(step) < 1e-12)
+            break;
+    }
+    double r2 = r * r;
+    if (r < 0 || fabs(r * (1 + k1 * r2 + k2 * r2 * r2) - rd) > 1e-9 || 1 + 3 * k1 * r2 + 5 * k2 * r2 * r2 <= 0)
+        return false;
+
+    undistorted = center + d * (r / rd);
+    return true;
+}
+
+Mat Warp::source_points(Size screen) const
+{
+    if (warp_kind == MAP)
+    {
+        if (map.size() != screen)
+            CV_Error(Error::StsBadSize, "the warp map is " + to_string(map.cols) + "x" + to_string(map.rows) +
+                     " but the screen is " + to_string(screen.width) + "x" + to_string(screen.height));
+        return map;
+    }
+
+    Mat points(screen, CV_32FC2);
+    Matx33d m(Mat(matrix.inv()));
+    parallel_for_(Range(0, screen.height), [&](const Range& rows){
+        for (int y = rows.start; y < rows.end; y++)
+        {
+            Point2f* point = points.ptr<Point2f>(y);
+            for (int x = 0; x < screen.width; x++)
+            {
+                Point2d u(x, y);
+                if (warp_kind == RADIAL && !undistort(Point2d(x, y), u))
+                    point[x] = NO_POINT;
+                else
+                    point[x] = project(m, u.x, u.y);
+            }
+        }
+    });
+    return points;
+}
+
+Mat Warp::screen_points(Size source) const
+{
+    Mat points(source, CV_32FC2);
+
+    if (warp_kind == MAP)
+    {
+        /* sequential, so the last screen pixel in raster order wins as it does for the scatter tables */
+        points.setTo(Scalar(NO_POINT.x, NO_POINT.y));
+        for (int y = 0; y < map.rows; y++)
+        {
+            const Point2f* point = map.ptr<Point2f>(y);
+            for (int x = 0; x < map.cols; x++)
+            {
+                int px = static_cast<int>(roundf(point[x].x));
+                int py = static_cast<int>(roundf(point[x].y));
+                if (px >= 0 && px < source.width && py >= 0 && py < source.height)
+                    points.at<Point2f>(py, px) = Point2f(static_cast<float>(x), static_cast<float>(y));
+            }
+        }
+        return points;
+    }
+
+    Matx33d m(matrix);
+    parallel_for_(Range(0, source.height), [&](const Range& rows){
+        for (int y = rows.start; y < rows.end; y++)
+        {
+            Point2f* point = points.ptr<Point2f>(y);
+            for (int x = 0; x < source.width; x++)
+            {
+                point[x] = project(m, x, y);
+                if (warp_kind == RADIAL)
+                {
+                    Point2d u(point[x].x, point[x].y);
+                    Point2d d = distort(u);
+                    point[x] = Point2f(static_cast<float>(d.x), static_cast<float>(d.y));
+                }
+            }
+        }
+    });
+    return points;
+}
+
+Warp Warp::scaled(double factor) const
+{
+    CV_Assert(factor > 0 && factor <= 1);
+    Warp warp = *this;
+
+    if (warp_kind == MAP)
+    {
+        /* point (x, y) of the scaled grid is point (x, y) / factor of the full one */
+        warp.map = Mat(Size(static_cast<int>(map.cols * factor), static_cast<int>(map.rows * factor)), CV_32FC2);
+        for (int y = 0; y < warp.map.rows; y++)
+        {
+            const Point2f* row = map.ptr<Point2f>(min(static_cast<int>(lround(y / factor)), map.rows - 1));
+            Point2f* point = warp.map.ptr<Point2f>(y);
+            for (int x = 0; x < warp.map.cols; x++)
+            {
+                Point2f p = row[min(static_cast<int>(lround(x / factor)), map.cols - 1)];
+                point[x] = p == NO_POINT ? NO_POINT : p * static_cast<float>(factor);
+            }
+        }
+        return warp;
+    }
+
+    /* S * H * S^-1 with S = diag(factor, factor, 1); the lens model scales with the screen */
+    Matx33d scale_down(factor, 0, 0, 0, factor, 0, 0, 0, 1);
+    Matx33d scale_up(1 / factor, 0, 0, 0, 1 / factor, 0, 0, 0, 1);
+    warp.matrix = Mat(scale_down * Matx33d(matrix) * scale_up);
+    warp.center = center * factor;
+    warp.norm = norm * factor;
+    return warp;
+}
+
+void Warp::describe(const function<void(const void* data, size_t size)>& feed) const
+{
+    if (warp_kind != MAP)
+    {
+        for (int r = 0; r < matrix.rows; r++)
+            feed(matrix.ptr<double>(r), matrix.cols * sizeof(double));
+    }
+    if (warp_kind == HOMOGRAPHY)
+        return;
+
+    int kind = warp_kind;
+    feed(&kind, sizeof(kind));
+    if (warp_kind == RADIAL)
+    {
+        double model[] = { center.x, center.y, norm, k1, k2 };
+        feed(model, sizeof(model));
+        return;
+    }
+    int size[] = { map.cols, map.rows };
+    feed(size, sizeof(size));
+    for (int y = 0; y < map.rows; y++)
+        feed(map.ptr<Point2f>(y), map.cols * sizeof(Point2f));
+}
+
+string Warp::summary() const
+{
+    char buffer[128];
+    if (warp_kind == HOMOGRAPHY)
+        snprintf(buffer, sizeof(buffer), "homography");
+    else if (warp_kind == RADIAL)
+        snprintf(buffer, sizeof(buffer), "homography with radial distortion k1 %.4f, k2 %.4f", k1, k2);
+    else
+        snprintf(buffer, sizeof(buffer), "%dx%d map", map.cols, map.rows);
+    return buffer;
+}
+
+
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <opencv2/core.hpp>
+
+using namespace std;
+using namespace cv;
+
+
+namespace ins
+{
+
+
+/* The mapping from source pixels to screen pixels that a LUT is built from.
+ *
+ * A homography (the 3x3 matrix of get_transform_matrix, which converts implicitly) is evaluated exactly in both
+ * directions. A radial warp applies the homography and then the radial lens model
+ *     screen = c + (u - c) * (1 + k1 r^2 + k2 r^4),  r = |u - c| / norm
+ * about the screen centre c, with norm half the screen diagonal, for fisheye projectors and domes; screen to source
+ * inverts the model numerically. A map warp is a cv::remap style map: the source coordinates of every screen pixel,
+ * for curved screens or any calibration a homography cannot express. Its source-to-screen direction, which the
+ * scatter tables need, assigns every source pixel the last screen pixel in raster order that samples it.
+ *
+ * Coordinates are in pixels; a point that has no counterpart is (-1, -1).
+ */
+class Warp
+{
+public:
+    enum Kind
+    {
+        HOMOGRAPHY,
+        RADIAL,
+        MAP
+    };
+
+    Warp(Mat homography);
+    static Warp radial(Mat homography, Size screen, double k1, double k2);
+    /* map_x and map_y CV_32FC1 of the screen size, or map_x CV_32FC2 and map_y empty, as for cv::remap */
+    static Warp from_maps(Mat map_x, Mat map_y);
+    /* CV_32SC1 source offset of every screen pixel in a source of the given stride; negative for none */
+    static Warp from_offsets(Mat offsets, int source_stride);
+    /* a cv::FileStorage file (.yml, .xml, .json) with map_x and map_y, map_xy, or offsets and source_stride;
+     * throws cv::Exception when the file holds none of them
+     */
+    static Warp load(const string& path);
+
+    Kind kind() const { return warp_kind; }
+    bool is_homography() const { return warp_kind == HOMOGRAPHY; }
+    /* source to screen homography; not defined for map warps */
+    const Mat& homography() const;
+    /* the screen size a map warp was made for; empty for the other kinds */
+    Size map_size() const { return map.size(); }
+
+    /* CV_32FC2 source coordinates of every screen pixel */
+    Mat source_points(Size screen) const;
+    /* CV_32FC2 screen coordinates of every source pixel */
+    Mat screen_points(Size source) const;
+
+    /* the same warp on a grid scaled by factor <= 1 in both directions, e.g. 0.5 for 4:2:0 chroma planes */
+    Warp scaled(double factor) const;
+
+    /* feeds the bytes the warp is defined by to a hash; for homographies these are the nine matrix elements */
+    void describe(const function<void(const void* data, size_t size)>& feed) const;
+    string summary() const;
+
+private:
+    Kind warp_kind;
+    Mat matrix;         // CV_64FC1 3x3
+    Point2d center;
+    double norm;
+    double k1, k2;
+    Mat map;            // CV_32FC2
+
+    Warp();
+    Point2d distort(Point2d point) const;
+    bool undistort(Point2d point, Point2d& undistorted) const;
+};
+
+
+}